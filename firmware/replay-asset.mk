@@ -0,0 +1,22 @@
+# Recordings placed in recordings/*.bin are embedded in the cold package, so
+# competition autons play without the SD card and without loading anything.
+# They are reached from code with REPLAY_ASSET(name) in replay_library.h.
+RECORDING_FILES=$(wildcard recordings/*.bin)
+
+ifneq (,$(RECORDING_FILES))
+RECORDING_OBJ=$(addprefix $(BINDIR)/, $(addsuffix .o, $(RECORDING_FILES)))
+RECORDING_LIB=$(BINDIR)/replay_recordings.a
+
+# Playback only ever reads them, so mark the blobs read-only
+$(RECORDING_OBJ): $(BINDIR)/%.o: %
+	$(VV)mkdir -p $(dir $@)
+	@echo "RECORDING $@"
+	$(VV)$(OBJCOPY) -I binary -O elf32-littlearm -B arm --rename-section .data=.rodata,alloc,load,readonly,data,contents $< $@
+
+$(RECORDING_LIB): $(RECORDING_OBJ)
+	-$(VV)rm -f $@
+	$(call test_output_2,Creating $@ ,$(AR) rcs $@ $^, $(DONE_STRING))
+
+# COLD_LIBRARIES comes from LIBRARIES, and the cold package links them --whole-archive
+LIBRARIES+=$(RECORDING_LIB)
+endif
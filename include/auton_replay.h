@@ -1,60 +1,181 @@
 #pragma once
 #include "main.h"
+#include "replay_format.h"
+#include "replay_stream.h"
+#include "replay_channels.h"
+#include "replay_timing.h"
+#include "replay_tracking.h"
+#include "replay_feedforward.h"
+#include "replay_heading.h"
+#include "replay_commands.h"
+#include "replay_latency.h"
+#include "lemlib/pose.hpp"
+#include "subsystems/outtake.h"
+#include "subsystems/pneumatics.h"
 #include <vector>
 #include <string>
 
-// Single frame of recorded data - captures all driver inputs at a moment in time
-struct RecordedFrame {
-    uint64_t timestamp;     // Time since recording started (microseconds for precision)
-    int8_t leftStick;       // Left joystick Y value (-127 to 127)
-    int8_t rightStick;      // Right joystick Y value (-127 to 127)
-    int8_t intakePower;     // Actual intake motor power (-127 to 127, from voltage)
-    int8_t outtakePower;    // Actual outtake motor power (-127 to 127, from voltage)
-    float heading;          // IMU heading at this frame (for drift correction)
-    
-    // Button states packed into bitflags for memory efficiency
-    // Bit 0: R1 (intake forward toggle) - kept for reference
-    // Bit 1: R2 (intake reverse toggle) - kept for reference
-    // Bit 2: L1 (outtake forward toggle) - kept for reference
-    // Bit 3: L2 (outtake reverse toggle) - kept for reference
-    // Bit 4: X (mid-scoring toggle)
-    // Bit 5: A (descore toggle)
-    // Bit 6: B (unloader toggle)
-    uint8_t buttons;
-};
-
-// Button bit positions
-constexpr uint8_t BTN_R1 = 0;
-constexpr uint8_t BTN_R2 = 1;
-constexpr uint8_t BTN_L1 = 2;
-constexpr uint8_t BTN_L2 = 3;
-constexpr uint8_t BTN_X  = 4;
-constexpr uint8_t BTN_A  = 5;
-constexpr uint8_t BTN_B  = 6;
-
 // Recording/Playback System with IMU correction and SD card persistence
 class AutonReplay {
 private:
-    std::vector<RecordedFrame> recording;
+    EncodedRecording recording;     // Encoded blocks, decoded frame-by-frame during playback
+    RecordingEncoder encoder;       // Buffers the current block while recording to RAM
+    ReplayStreamWriter streamWriter;  // Writes blocks to the SD card while recording
+    bool streaming = false;         // Current recording is going straight to the SD card
+    ReplayStreamReader streamReader;  // Reads blocks ahead of playback when streaming from SD
+    bool streamingPlayback = false;   // Play from the SD card instead of loading into RAM
+    ChangeFilter changeFilter;      // Picks the frames worth keeping in change-only mode
+    bool changesOnly = false;       // Record only frames where something changed
+    uint32_t keyframeMs = 500;      // Change-only mode still stores a full frame this often
+    uint32_t playbackPeriodMs = REPLAY_PLAYBACK_PERIOD_MS;  // Longest gap between scheduler passes
+    bool interpolatedPlayback = false;  // Blend continuous channels between frames on every pass
+    float timeScale = 1.0f;         // Playback speed relative to the recording
+    float maxDriveAccel = 0.0f;     // Limit on scaled stick change (counts per second), 0 = none
+    uint32_t lastPlaybackMs = 0;    // How long the last playback actually took
+    bool poseTracking = false;      // Follow the recorded odometry path instead of only the heading
+    RamseteTracker tracker;
+    float maxPoseError = 0.0f;      // Worst distance from the recorded path in the last playback (inches)
+    bool velocityPlayback = false;  // Replay measured velocities through the motors' velocity loops
+    bool velocityActive = false;    // This playback is in velocity mode (recording has the channels)
+    float driveMaxRpm = 600.0f;     // Drive gearset top speed - maps velocities to stick counts
+    uint16_t batteryMv = 0;         // Battery voltage being logged (re-read every REPLAY_BATTERY_PERIOD_MS)
+    uint32_t batteryReadMs = 0;     // Recording time of the last battery read
+    bool voltageCompensation = false;  // Scale open-loop commands by recorded / current battery voltage
+    float voltageRatio = 1.0f;      // Scale for this playback pass
+    uint32_t compensatedPasses = 0; // Passes the drive was compensated in, last playback
+    uint32_t saturatedPasses = 0;   // ...and how many of those wanted more than full power
+    bool modelPlayback = false;     // Drive from the recording's fitted feedforward models
+    bool modelActive = false;       // This playback is model-based (recording has drive models)
+    RecordingInfo playInfo;         // Header of the recording being played (for its models)
+    TimingStats playbackTiming;     // Per-frame lateness of the last playback
+    CatchUpPolicy catchUpPolicy = CatchUpPolicy::COALESCE;
+    uint32_t coalescedFrames = 0;   // Overdue frames skipped over in the last playback
+    uint32_t timeShiftUs = 0;       // How far the last playback's timeline was pushed back
     uint64_t recordStartTime = 0;  // Microseconds for precision timing
     bool _isRecording = false;
     bool _isPlaying = false;
     bool _abortRequested = false;  // For emergency stop during playback
+    bool lastAborted = false;       // Last playback was stopped early
+    const SegmentSource* segment = nullptr;  // Part of a recording being played (see playSegment())
+    
+    // Recording flattened into plain commands ahead of time (see preload())
+    CommandStream compiled;
+    int compiledSlot = -1;          // Slot the commands came from, -1 if none
+    bool compiledEmbedded = false;  // ...and whether from its embedded recording
+    
+    // opcontrol's state machines, logged into CH_MECHANISMS while recording.
+    // Without them the state is rebuilt from the button edges instead.
+    OuttakeControl* outtakeSource = nullptr;
+    PneumaticControl* pneumaticSource = nullptr;
+    MechanismTracker recordMechanisms;
+    
+    // Playback's own copies of the same state machines, driven by the recorded transitions
+    OuttakeControl playbackOuttake;
+    PneumaticControl playbackPneumatics;
+    
+    // Actuator latencies, and playing each actuator's commands early by its own
+    LatencyTable latency;
+    bool latencyCompensation = false;
+    uint16_t pistonLatencyMs = REPLAY_PISTON_LATENCY_MS;
+    LeadSource leadSource;
+    
+    // Path length rolled by the tracking wheel since recording/playback started (inches)
+    float travel = 0.0f;
+    float lastWheel = 0.0f;
+    bool distanceIndexed = false;   // Advance playback by distance travelled instead of time
+    uint32_t distanceLagUs = 0;     // How far the lag limit pushed the last playback along
+    
+    // Checkpoints: marked with markCheckpoint() or found at stops while
+    // recording, and re-synced to during playback
+    bool checkpointPending = false;
+    bool autoCheckpoints = true;
+    bool movedSinceCheckpoint = false;
+    uint32_t stillSinceMs = 0;      // Recording time the drive last moved
+    bool checkpointResync = false;
+    float resyncDistance = REPLAY_RESYNC_DISTANCE;
+    float resyncHeading = REPLAY_RESYNC_HEADING;
+    uint32_t resyncCount = 0;       // Corrections made in the last playback, and the time they took
+    uint32_t resyncMs = 0;
     
-    // Previous button states for edge detection during playback
-    uint8_t prevButtons = 0;
+    // Modes picked for the recording being played (see selectModes())
+    bool trackingActive = false;
+    bool compensatingActive = false;
+    bool distanceActive = false;
+    bool resyncActive = false;
     
-    // IMU correction settings
-    float imuCorrectionGain = 2.0f;  // How aggressively to correct heading drift
+    // Holds the recorded heading from its own task while playing (unless pose tracking)
+    HeadingController headingController;
     
     // Countdown before recording starts (milliseconds)
     uint32_t countdownDuration = 3000;  // 3 second countdown by default
     
-    // File path for SD card storage
+    // Library slot being recorded/played, and its file on the SD card
+    int currentSlot = 0;
     std::string filePath = "/usd/auton_recording.bin";
     
-    // Helper to apply IMU heading correction
-    void applyHeadingCorrection(int& left, int& right, float targetHeading, float currentHeading);
+    // Hand a frame to the stream writer or the RAM encoder. False if RAM is full.
+    bool storeFrame(const RecordedFrame& frame);
+    
+    // Summarize the slot's file in the library index after a save
+    void updateLibrary(uint32_t fileSize, uint32_t checksum);
+    
+    // Drive the robot from source until it runs out of frames or is aborted
+    void play(FrameSource& source);
+    
+    // Walk the compiled commands instead - the plain open-loop path with every
+    // per-frame decision already made
+    void playCompiled();
+    
+    // Set up and tear down around either playback path
+    void beginPlayback();
+    void endPlayback();
+    
+    // Pick pose tracking, velocity, model and compensation modes for a recording
+    void selectModes(const RecordingInfo& info);
+    
+    // Can a recording with this header play from the compiled commands with the current settings?
+    bool canPlayCompiled(const RecordingInfo& info);
+    
+    // source with the latency leads applied, or source itself when they're off
+    FrameSource& withLeads(FrameSource& source);
+    
+    // Flatten the current slot's recording (in RAM, or its embedded one) into compiled
+    bool compileRecording(bool embedded);
+    
+    // Start travel over from the tracking wheel's current reading
+    void resetTravel();
+    
+    // Add the tracking wheel's movement since the last call to travel, and return it
+    float updateTravel();
+    
+    // CH_CHECKPOINT value for the frame being recorded at timeMs, given the drive's speed
+    uint8_t nextCheckpoint(float leftVel, float rightVel, uint32_t timeMs);
+    
+    // Drive back to a checkpoint's recorded pose with LemLib if odometry has
+    // strayed past the re-sync limits. Returns whether it had to.
+    bool resyncTo(const RecordedFrame& checkpoint);
+    
+    // One drive side's command in stick counts (+-127): the recorded stick, or
+    // in velocity mode the measured speed as a share of the gearset's top speed
+    float driveCommand(const RecordedFrame& frame, bool rightSide) const;
+    
+    // Feedforward command in stick counts for the motion recorded at frame,
+    // accelerating towards next (optional), at playback speed
+    float modelCommand(const ActuatorModel& model, const RecordedFrame& frame, const RecordedFrame* next, float speed) const;
+    
+    // Fit feedforward models to the recording just made and store them in its header
+    void fitModels();
+    
+    // Send a frame's intake/outtake command and run the registered mechanisms
+    void driveMechanisms(const RecordedFrame& frame);
+    
+    // Playback speed for the segment between two frames: the time scale, reduced
+    // where scaled drive commands would pass 127 or the acceleration limit
+    float segmentSpeed(const RecordedFrame& from, const RecordedFrame& to) const;
+    
+    // Pose tracking: add the RAMSETE correction towards the recorded pose in
+    // target to the recorded sticks. next (optional) gives the reference velocity.
+    void applyPoseCorrection(int& left, int& right, const RecordedFrame& target, const RecordedFrame* next, float speed);
     
     // Helper to display countdown on screen and controller
     void displayCountdown(int secondsRemaining);
@@ -63,18 +184,58 @@ private:
     bool checkEmergencyStop();
     
 public:
+    // Reserve all recording buffers from the replay arena. Call once from
+    // initialize(), after registering any extra channels.
+    void init();
+    
     // Start recording driver inputs
     void startRecording();
     
-    // Stop recording and optionally save to SD card
+    // Stop recording and optionally save to SD card. A recording streamed to
+    // the card is thrown away when not saved, as it isn't held in RAM.
     void stopRecording(bool saveToSD = true);
     
     // Record a single frame (call this in opcontrol loop at 20ms intervals)
     void recordFrame();
     
+    // Log these state machines' transitions while recording (call once at the
+    // top of opcontrol), so playback runs the same sequences, unjam included
+    void attachMechanisms(OuttakeControl* outtake, PneumaticControl* pneumatics) {
+        outtakeSource = outtake;
+        pneumaticSource = pneumatics;
+    }
+    
     // Playback the recording in autonomous (with IMU drift correction)
     void playback();
     
+    // Play the recording embedded in the program for a slot (see REPLAY_ASSET).
+    // Returns false if the slot has none.
+    bool playEmbedded(int slot);
+    
+    // Play fromMs to toMs of a slot's recording (embedded, else RAM or SD card)
+    // from wherever the robot is, as one step of a longer routine (see
+    // AutonTimeline). origin is where the recording started on the field;
+    // odometry is in the recording's frame while it plays and back in the
+    // field's afterwards. If the recording has pose, the robot first drives to
+    // the segment's start pose if it is off by more than the re-sync limits.
+    // Mechanism states carry over from before and are then set to what the
+    // recording had at fromMs; the intake/outtake keep running at the end.
+    // Returns false if the slot has no recording, the segment is empty, or it
+    // was aborted.
+    bool playSegment(int slot, uint32_t fromMs, uint32_t toMs, const lemlib::Pose& origin);
+    
+    // Wait for the LemLib motion in progress, and at least atLeastMs, keeping
+    // the playback mechanisms running. Returns false (motion cancelled) on
+    // emergency stop.
+    bool waitForMotion(uint32_t atLeastMs = 0);
+    
+    // Put one of playback's mechanism state machines (MechanismId) into a
+    // state. Segments and timelines pick up from whatever is set here.
+    void setMechanism(uint8_t output, bool value);
+    
+    // Playback's mechanism state machines back to everything off
+    void resetMechanisms();
+    
     // Clear the current recording
     void clearRecording();
     
@@ -84,8 +245,21 @@ public:
     // Load recording from SD card
     bool loadFromSD();
     
+    // Switch to a library slot (drops the in-RAM recording if the slot changes)
+    void selectSlot(int slot);
+    int getSlot() const { return currentSlot; }
+    
+    // Select a slot and decode its recording into RAM ahead of time, so playback()
+    // starts driving immediately. The recording (or the slot's embedded one) is
+    // also compiled into plain commands for the current playback settings, so
+    // set those first. Returns false if the slot has nothing to play.
+    bool preload(int slot);
+    
+    // Does the current slot have a recording (in RAM or on the SD card)?
+    bool hasRecording() const;
+    
     // Get recording size (number of frames)
-    int getFrameCount() const { return recording.size(); }
+    int getFrameCount() const { return recording.info.frameCount; }
     
     // Get recording duration in milliseconds
     uint32_t getDuration() const;
@@ -96,8 +270,150 @@ public:
     // Is currently playing?
     bool isPlaying() const { return _isPlaying; }
     
-    // Set IMU correction gain (higher = more aggressive correction)
-    void setIMUCorrectionGain(float gain) { imuCorrectionGain = gain; }
+    // Set IMU correction gain (higher = more aggressive correction). This is
+    // the heading controller's kP; see setHeadingGains() for the rest.
+    void setIMUCorrectionGain(float gain) {
+        HeadingGains gains = headingController.getGains();
+        gains.kP = gain;
+        headingController.setGains(gains);
+    }
+    
+    // Tune the heading controller: PID gains, gyro-rate damping, anti-windup
+    // limit and how much the gains back off at full forward speed
+    void setHeadingGains(HeadingGains gains) { headingController.setGains(gains); }
+    
+    // Largest heading error during the last heading-corrected playback (degrees)
+    float getMaxHeadingError() const { return headingController.getMaxError(); }
+    
+    // Play straight from the SD card (bounded RAM, no load delay) when the recording isn't in RAM
+    void setStreamingPlayback(bool enabled) { streamingPlayback = enabled; }
+    
+    // Only store a frame when a channel moves past its threshold (see ChannelDef),
+    // plus a keyframe every keyframeMs. Much smaller recordings and far fewer SD
+    // writes; playback holds each value until the next stored frame.
+    void setChangeOnlyRecording(bool enabled, uint32_t keyframeMs = 500) {
+        changesOnly = enabled;
+        this->keyframeMs = keyframeMs;
+    }
+    
+    // Longest time playback sleeps between passes (drive refresh, heading correction,
+    // emergency stop). Frames are still sent on their own deadlines in between.
+    void setPlaybackPeriod(uint32_t ms) { playbackPeriodMs = ms > 0 ? ms : 1; }
+    
+    // Resample sticks, intake/outtake, heading target and any interpolating
+    // registered channel linearly between frames, so every playback pass (see
+    // setPlaybackPeriod) sends fresh values instead of a 50 Hz staircase
+    void setInterpolatedPlayback(bool enabled) { interpolatedPlayback = enabled; }
+    
+    // Play recordings faster (e.g. 1.15) or slower than they were driven. Drive
+    // commands scale with the timeline; segments where that would pass full
+    // power, or change the sticks faster than maxAccel counts per second (0 = no
+    // limit), play slower. Clamped to 0.5-2.0.
+    void setTimeScale(float scale, float maxAccel = 0.0f) {
+        timeScale = scale < 0.5f ? 0.5f : (scale > 2.0f ? 2.0f : scale);
+        maxDriveAccel = maxAccel;
+    }
+    
+    // How long the last playback took (milliseconds), to compare against getDuration()
+    uint32_t getPlaybackDuration() const { return lastPlaybackMs; }
+    
+    // Close the loop on position: recordings log the odometry pose every frame,
+    // and playback steers back onto that path with a RAMSETE controller. The
+    // recorded sticks stay as feedforward. Recordings without pose fall back
+    // to heading correction.
+    void setPoseTracking(bool enabled, RamseteGains gains = RamseteGains()) {
+        poseTracking = enabled;
+        tracker.setGains(gains);
+    }
+    
+    // Replay the measured drive and intake/outtake velocities with move_velocity()
+    // instead of stick values and voltages with move(), so the motors' own
+    // velocity loops hit the recorded speeds whatever the battery level.
+    // Recordings without velocity channels play open loop as before.
+    void setVelocityPlayback(bool enabled) { velocityPlayback = enabled; }
+    
+    // Drive with move_voltage() from the kS/kV/kA models fitted to the recording
+    // (done automatically when a recording is saved): the recorded velocities
+    // become exact voltage commands. Intake/outtake follow suit when they have
+    // models. Needs a recording with velocity channels and fitted drive models.
+    void setModelPlayback(bool enabled) { modelPlayback = enabled; }
+    
+    // Scale open-loop drive and intake/outtake commands by the battery voltage
+    // at recording time over the voltage now, so a replay puts the same effort
+    // into the motors at any charge. Commands are clamped to full power; how
+    // often that happened is reported by getSaturation().
+    void setVoltageCompensation(bool enabled) { voltageCompensation = enabled; }
+    
+    // Advance playback by the distance the tracking wheel has rolled rather
+    // than by the clock, so the robot does the same thing at the same place
+    // when it runs slow (low battery, pushing a game element, wheel slip).
+    // Segments recorded standing still play by time, and playback never lags
+    // the clock by more than REPLAY_DISTANCE_MAX_LAG_MS. Recordings without
+    // the travel channel play by time.
+    void setDistanceIndexedPlayback(bool enabled) { distanceIndexed = enabled; }
+    
+    // How much the last distance-indexed playback had to be pushed along by the lag limit (ms)
+    uint32_t getDistanceLagMs() const { return distanceLagUs / 1000; }
+    
+    // Mark the frame being recorded as a checkpoint (Y in opcontrol)
+    void markCheckpoint() {
+        if (_isRecording) checkpointPending = true;
+    }
+    
+    // Also mark a checkpoint wherever the drive stops for REPLAY_CHECKPOINT_STOP_MS (default on)
+    void setAutoCheckpoints(bool enabled) { autoCheckpoints = enabled; }
+    
+    // At each checkpoint, if odometry puts the robot more than maxDistance
+    // inches or maxHeading degrees off the recorded pose, pause the recording
+    // and drive back onto it with LemLib (moveToPose, or turnToHeading for
+    // heading alone) before going on. Error stops at each checkpoint instead
+    // of building up over the run. Needs a recording with checkpoints and pose.
+    void setCheckpointResync(bool enabled, float maxDistance = REPLAY_RESYNC_DISTANCE,
+                             float maxHeading = REPLAY_RESYNC_HEADING) {
+        checkpointResync = enabled;
+        resyncDistance = maxDistance;
+        resyncHeading = maxHeading;
+    }
+    
+    // Checkpoint corrections in the last playback, and the time they took (ms)
+    uint32_t getResyncCount() const { return resyncCount; }
+    uint32_t getResyncMs() const { return resyncMs; }
+    
+    // Time command-to-motion latency of the drive, intake and outtake (median
+    // of a few short pulses each, robot on the ground and clear) and save it to
+    // the SD card. Returns false if an actuator never moved.
+    bool calibrateLatency();
+    
+    // Send each actuator's commands early by its calibrated latency, so the
+    // hardware moves when it did while recording instead of that much later.
+    // Call before preload() so compiled recordings include the leads.
+    void setLatencyCompensation(bool enabled) {
+        latencyCompensation = enabled;
+        compiledSlot = -1;
+    }
+    
+    // Lead for the pistons, which have no feedback to calibrate against (ms)
+    void setPistonLatency(uint16_t ms);
+    
+    const LatencyTable& getLatency() const { return latency; }
+    
+    // Share of compensated playback passes (0 - 1) where the drive hit full power
+    float getSaturation() const { return compensatedPasses > 0 ? static_cast<float>(saturatedPasses) / compensatedPasses : 0.0f; }
+    
+    // Largest distance from the recorded path during the last pose-tracked playback (inches)
+    float getMaxPoseError() const { return maxPoseError; }
+    
+    // How late each frame of the last playback was sent, relative to its recorded time
+    const TimingStats& getPlaybackTiming() const { return playbackTiming; }
+    
+    // How to handle several frames falling due in one pass after a late
+    // wake-up (see CatchUpPolicy). Default COALESCE. TIME_SHIFT kicks in once
+    // a pass is more than one playback period late.
+    void setCatchUpPolicy(CatchUpPolicy policy) { catchUpPolicy = policy; }
+    
+    // Frames coalesced away, and total time shifted (ms), in the last playback
+    uint32_t getCoalescedFrames() const { return coalescedFrames; }
+    uint32_t getTimeShiftMs() const { return timeShiftUs / 1000; }
     
     // Set countdown duration before recording starts (in milliseconds)
     void setCountdownDuration(uint32_t ms) { countdownDuration = ms; }
@@ -105,6 +421,10 @@ public:
     // Abort playback (call from emergency stop)
     void abortPlayback();
     
+    // Peak bytes used in the RAM recording buffer, and its size
+    size_t getBufferPeak() const { return recording.blocks.getPeak(); }
+    size_t getBufferCapacity() const { return recording.blocks.capacity(); }
+    
     // Check if SD card is present
     bool isSDCardInserted() const;
     
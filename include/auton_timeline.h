@@ -0,0 +1,111 @@
+#pragma once
+#include "auton_replay.h"
+#include "lemlib/api.hpp" // IWYU pragma: keep
+#include <cstdint>
+
+// Most steps one timeline can hold
+constexpr uint8_t TIMELINE_MAX_STEPS = 32;
+
+// An autonomous routine built from recorded segments and LemLib motions.
+//
+// Steps run in order: LemLib motions for the long, simple traverses, and
+// pieces of a recording (trimmed by time) for the driving that's hard to
+// write down, like scoring and unloading. Odometry carries through every
+// step. Each segment is mapped onto the field from the pose the routine
+// started at (the recording's 0,0,0), and the robot drives onto the
+// segment's recorded start first if it isn't there. The mechanism state
+// machines also carry through: segments set what their recording had, and
+// mechanism() steps set them by hand in between.
+//
+//   AutonTimeline skills;
+//   skills.moveToPoint(-31.75, 2, 2000)
+//         .replay(0, 4200, 9800)            // Slot 0, 4.2 s to 9.8 s of the recording
+//         .mechanism(MECH_UNLOADER, false)
+//         .follow(skills_path_txt, 10, 4000)
+//         .replay(0, 21000, 26500);
+//   chassis.setPose(0, 0, 270);
+//   skills.run();
+//
+// Steps are kept in a fixed array, so building a timeline never allocates.
+class AutonTimeline {
+private:
+    enum class StepType : uint8_t {
+        REPLAY,
+        MOVE_TO_POINT,
+        MOVE_TO_POSE,
+        TURN_TO_HEADING,
+        FOLLOW,
+        MECHANISM,
+        WAIT,
+        CALL
+    };
+
+    struct Step {
+        StepType type = StepType::WAIT;
+        int slot = 0;                   // REPLAY
+        uint32_t fromMs = 0;
+        uint32_t toMs = 0;
+        float x = 0.0f;                 // Motion targets (inches, degrees)
+        float y = 0.0f;
+        float theta = 0.0f;
+        int timeout = 0;                // Motion timeout, or WAIT time (ms)
+        lemlib::MoveToPointParams pointParams;
+        lemlib::MoveToPoseParams poseParams;
+        lemlib::TurnToHeadingParams turnParams;
+        const asset* path = nullptr;    // FOLLOW
+        float lookahead = 0.0f;
+        bool forwards = true;
+        uint8_t mechanism = 0;          // MECHANISM (MechanismId)
+        bool value = false;
+        void (*action)() = nullptr;     // CALL
+    };
+
+    Step steps[TIMELINE_MAX_STEPS];
+    uint8_t count = 0;
+    bool overflowed = false;            // A step didn't fit - run() refuses to start
+
+    lemlib::Pose origin{0, 0, 0};
+    bool originSet = false;
+
+    // Next free step, or nullptr (and overflowed) when full
+    Step* add(StepType type);
+
+    bool runStep(const Step& step, const lemlib::Pose& start);
+
+public:
+    // Play fromMs to toMs of a slot's recording (the rest of it by default)
+    AutonTimeline& replay(int slot, uint32_t fromMs = 0, uint32_t toMs = UINT32_MAX);
+
+    // LemLib motions, as the chassis functions of the same name, run to completion
+    AutonTimeline& moveToPoint(float x, float y, int timeout, lemlib::MoveToPointParams params = {});
+    AutonTimeline& moveToPose(float x, float y, float theta, int timeout, lemlib::MoveToPoseParams params = {});
+    AutonTimeline& turnToHeading(float theta, int timeout, lemlib::TurnToHeadingParams params = {});
+    AutonTimeline& follow(const asset& path, float lookahead, int timeout, bool forwards = true);
+
+    // Set a mechanism state machine (MechanismId), as a recording would
+    AutonTimeline& mechanism(uint8_t id, bool value);
+
+    // Wait, keeping the mechanisms running
+    AutonTimeline& wait(uint32_t ms);
+
+    // Run any other code (set the intake, say) - it should return promptly
+    AutonTimeline& call(void (*action)());
+
+    // Where the recordings' 0,0,0 is on the field. By default, wherever the
+    // robot is when run() starts - the recordings were made from the same spot.
+    void setOrigin(const lemlib::Pose& pose) {
+        origin = pose;
+        originSet = true;
+    }
+
+    // Run every step in order, starting with the mechanisms off. Stops at the
+    // first step that fails (missing recording, emergency stop) and returns false.
+    bool run();
+
+    void clear() {
+        count = 0;
+        overflowed = false;
+    }
+
+    uint8_t size() const { return count; }
+};
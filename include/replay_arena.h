@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Size of the fixed region recording and playback buffers are carved from.
+// Sized so the guaranteed recording (REPLAY_GUARANTEED_MS) fits with every
+// channel slot in use, plus the encoder and SD streaming buffers.
+constexpr size_t REPLAY_ARENA_SIZE = 384 * 1024;
+
+// Length of recording that is guaranteed to fit in RAM whatever the driving
+// (a full skills run). Blocks that don't compress fall back to packed storage,
+// so the worst case is known ahead of time - see worstCaseBlocksSize().
+constexpr uint32_t REPLAY_GUARANTEED_MS = 60000;
+
+// Bump allocator over one static buffer. Nothing comes from the heap, nothing
+// is ever freed, and allocate() never throws - it returns nullptr when full.
+// Every buffer is carved once at startup (AutonReplay::init()) and reused.
+class ReplayArena {
+private:
+    size_t used = 0;
+
+public:
+    void* allocate(size_t size, size_t align = 4) noexcept;
+
+    size_t getUsed() const { return used; }
+    size_t getCapacity() const { return REPLAY_ARENA_SIZE; }
+};
+
+// Global instance
+extern ReplayArena replayArena;
+
+// Fixed-capacity byte buffer carved from the arena. Writes past the end are
+// dropped and flagged instead of growing, so appending can't allocate or throw.
+class ByteBuffer {
+private:
+    uint8_t* bytes = nullptr;
+    size_t length = 0;
+    size_t cap = 0;
+    size_t peak = 0;            // High-water mark of size()
+    bool overflow = false;
+
+public:
+    // Make sure there's room for capacity bytes, carving a new region from the
+    // arena if the current one is too small. Meant to be called once up front.
+    bool reserve(size_t capacity) noexcept;
+
+    bool push_back(uint8_t b) noexcept;
+    bool append(const uint8_t* src, size_t count) noexcept;
+
+    // Grow (contents unspecified) or shrink. Growing past capacity fails and sets the overflow flag.
+    bool resize(size_t size) noexcept;
+
+    // Shrink back to size and clear the overflow flag (for rolling back a partial write)
+    void truncate(size_t size) noexcept;
+
+    void clear() noexcept { truncate(0); }
+
+    uint8_t* data() { return bytes; }
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+    size_t capacity() const { return cap; }
+    bool empty() const { return length == 0; }
+    bool overflowed() const { return overflow; }
+    size_t getPeak() const { return peak; }
+};
@@ -0,0 +1,117 @@
+#pragma once
+#include "replay_format.h"
+
+// Describes one recorded channel: how it is stored and what it means
+struct ChannelDef {
+    uint8_t id;                             // ReplayChannel (CH_USER_FIRST and up for new mechanisms)
+    uint8_t type;                           // ChannelType - width on disk
+    float scale;                            // Real units per raw count (e.g. 0.01 degrees for heading)
+    int32_t modulus;                        // Non-zero for values that wrap around (heading: 36000)
+    bool secondOrder;                       // Stored as delta-of-delta (steady ramps like the timestamp)
+    const char* name;
+    int32_t (*sample)();                    // Reads the live raw value while recording (optional)
+    void (*apply)(int32_t value);           // Drives the mechanism from a raw value during playback (optional)
+    int32_t threshold;                      // Change-only recording: moves of this many raw counts or less are ignored
+    bool interpolate;                       // Continuous value - interpolated playback may blend between frames
+};
+
+// The channels this build records, in file order.
+//
+// The drive, heading, button, pose, velocity, battery, mechanism, travel and checkpoint channels are built in and handled directly by
+// AutonReplay. Other mechanisms register a channel at startup (before the first
+// recording) with sample/apply callbacks - recording, playback and the file
+// format then pick them up without any change to auton_replay.cpp:
+//
+//   replayChannels.add({CH_USER_FIRST, CHT_I16, 1.0f, 0, false, "lift",
+//                       [] { return (int32_t)lift.get_position(); },
+//                       [](int32_t v) { lift.move_absolute(v, 200); },
+//                       5, true});
+class ChannelRegistry {
+private:
+    ChannelDef defs[REPLAY_MAX_CHANNELS];
+    uint8_t count;
+
+public:
+    constexpr ChannelRegistry()
+        : defs{
+              {CH_TIMESTAMP,   CHT_U32, 1e-6f, 0,     true,  "time",    nullptr, nullptr, 0,  false},
+              {CH_LEFT_STICK,  CHT_I8,  1.0f,  0,     false, "left",    nullptr, nullptr, 2,  true},
+              {CH_RIGHT_STICK, CHT_I8,  1.0f,  0,     false, "right",   nullptr, nullptr, 2,  true},
+              {CH_INTAKE,      CHT_I8,  1.0f,  0,     false, "intake",  nullptr, nullptr, 0,  true},
+              {CH_OUTTAKE,     CHT_I8,  1.0f,  0,     false, "outtake", nullptr, nullptr, 0,  true},
+              {CH_HEADING,     CHT_U16, 0.01f, 36000, false, "heading", nullptr, nullptr, 50, true},
+              {CH_BUTTONS,     CHT_U8,  1.0f,  0,     false, "buttons", nullptr, nullptr, 0,  false},
+              {CH_POSE_X,      CHT_I16, 0.01f, 0,     false, "pose x",  nullptr, nullptr, 10, true},
+              {CH_POSE_Y,      CHT_I16, 0.01f, 0,     false, "pose y",  nullptr, nullptr, 10, true},
+              {CH_LEFT_VEL,    CHT_I16, 0.1f,  0,     false, "left v",  nullptr, nullptr, 50, true},
+              {CH_RIGHT_VEL,   CHT_I16, 0.1f,  0,     false, "right v", nullptr, nullptr, 50, true},
+              {CH_INTAKE_VEL,  CHT_I16, 0.1f,  0,     false, "intk v",  nullptr, nullptr, 50, true},
+              {CH_OUTTAKE_VEL, CHT_I16, 0.1f,  0,     false, "outk v",  nullptr, nullptr, 50, true},
+              {CH_BATTERY,     CHT_U16, 0.001f, 0,    false, "battery", nullptr, nullptr, 100, true},
+              {CH_MECHANISMS,  CHT_U8,  1.0f,  0,     false, "mechs",   nullptr, nullptr, 0,  false},
+              {CH_TRAVEL,      CHT_U32, 0.01f, 0,     false, "travel",  nullptr, nullptr, 50, true},
+              {CH_CHECKPOINT,  CHT_U8,  1.0f,  0,     false, "checkpt", nullptr, nullptr, 0,  false},
+          },
+          count(17) {}
+
+    // Register a new channel. Fails if the ID is out of range or taken, the type
+    // is unknown, or the registry is full.
+    bool add(const ChannelDef& def);
+
+    uint8_t size() const { return count; }
+    const ChannelDef& get(uint8_t index) const { return defs[index]; }
+
+    // nullptr if the ID isn't registered
+    const ChannelDef* find(uint8_t id) const;
+
+    // Write the channel list into a recording header
+    void describe(RecordingInfo& info) const;
+
+    // Fill every channel that has a sample callback
+    void sample(RecordedFrame& frame) const;
+
+    // Call every apply callback with the frame's value
+    void apply(const RecordedFrame& frame) const;
+
+    // Does any channel have an apply callback?
+    bool hasApply() const;
+
+    // Blend the interpolating channels linearly between two frames at time
+    // (microseconds, between their timestamps). Modular channels take the short
+    // way round. Everything else keeps from's value.
+    void interpolate(const RecordedFrame& from, const RecordedFrame& to, uint32_t time, RecordedFrame& out) const;
+
+    // Convert between real units and raw stored values (wrapped for modular channels)
+    int32_t toRaw(uint8_t id, float units) const;
+    float toUnits(uint8_t id, int32_t raw) const;
+};
+
+// Global instance
+extern ChannelRegistry replayChannels;
+
+// Decides which sampled frames a change-only recording keeps.
+//
+// A frame is kept when any channel has moved past its threshold since the last
+// kept frame, or when a keyframe is due. Channels that moved less than their
+// threshold keep their held value, so they stay flat and cost next to nothing
+// in the columnar encoding. Playback holds each value until the next kept
+// frame, which rebuilds the same commands.
+class ChangeFilter {
+private:
+    RecordedFrame held;                     // Last kept frame
+    RecordedFrame skipped;                  // Last frame that wasn't kept (held values, latest timestamp)
+    bool haveHeld = false;
+    bool haveSkipped = false;
+    uint32_t keyframeUs = 0;
+
+public:
+    // Start a new recording. keyframeMs of 0 disables keyframes.
+    void begin(uint32_t keyframeMs);
+
+    // Should frame be stored? Channels under their threshold are rewritten to the held value.
+    bool accept(RecordedFrame& frame);
+
+    // The last sampled frame if it wasn't kept - store it on stop so the
+    // recording still ends at its real length. Returns false if there is none.
+    bool tail(RecordedFrame& frame);
+};
@@ -0,0 +1,148 @@
+#pragma once
+#include "replay_format.h"
+#include <cstdint>
+#include <cstddef>
+
+// Button bit positions
+constexpr uint8_t BTN_R1 = 0;
+constexpr uint8_t BTN_R2 = 1;
+constexpr uint8_t BTN_L1 = 2;
+constexpr uint8_t BTN_L2 = 3;
+constexpr uint8_t BTN_X  = 4;
+constexpr uint8_t BTN_A  = 5;
+constexpr uint8_t BTN_B  = 6;
+
+// Mechanism states replayed as events: mid-scoring mode (X), descore (A), unloader (B)
+enum MechanismId : uint8_t {
+    MECH_MID_SCORING = 0,
+    MECH_DESCORE = 1,
+    MECH_UNLOADER = 2,
+    MECH_COUNT = 3
+};
+
+// CH_MECHANISMS bits: the state machines' state as opcontrol left it each frame
+constexpr uint8_t MECH_STATE_MID_SCORING = 0x01;
+constexpr uint8_t MECH_STATE_UNJAM = 0x02;      // Unjam pulse running (follows entering mid-scoring)
+constexpr uint8_t MECH_STATE_DESCORE = 0x04;
+constexpr uint8_t MECH_STATE_UNLOADER = 0x08;
+
+// Most mechanism events a compiled recording can hold (a change every 10 frames of a full run)
+constexpr size_t REPLAY_MAX_EVENTS = 512;
+
+// Set a mechanism state to value at time
+struct MechanismEvent {
+    uint32_t time;              // Playback microseconds
+    uint8_t output;             // MechanismId
+    uint8_t value;
+};
+
+// Everything one recorded frame sends in plain open-loop playback, ready to go out
+struct PlaybackCommand {
+    uint32_t time;              // Playback microseconds, time scale applied
+    int8_t left;                // Drive sticks, time-scaled and clamped
+    int8_t right;
+    int8_t intake;              // Intake/outtake move() values
+    int8_t outtake;
+    uint16_t heading;           // Target heading, raw CH_HEADING counts
+};
+
+// Turns a recording into explicit mechanism set-value events, in one place
+// for the compiler, live playback and the recorder. Recordings with the
+// CH_MECHANISMS channel give the logged state transitions directly; older
+// ones are rebuilt from button edges and toggle state.
+class MechanismTracker {
+private:
+    uint8_t prevButtons = 0;
+    uint8_t states = 0;         // Bit per MechanismId
+    bool fromStates = false;
+
+public:
+    // Start over. fromStates follows CH_MECHANISMS instead of the buttons.
+    void reset(bool fromStates) {
+        prevButtons = 0;
+        states = 0;
+        this->fromStates = fromStates;
+    }
+
+    // Events caused by a frame, written to out (room for MECH_COUNT). Returns how many.
+    uint8_t step(const RecordedFrame& frame, uint32_t time, MechanismEvent* out);
+
+    // Current state as CH_MECHANISMS bits
+    uint8_t getStateBits() const;
+
+    // Current state of one mechanism (MechanismId)
+    bool getState(uint8_t mechanism) const { return (states >> mechanism) & 1; }
+};
+
+// Part of a recording, fromMs to toMs, played as a recording of its own:
+// timestamps and travel start again from zero at its first frame. Pose and
+// heading are left as recorded. The mechanism tracker has been run over the
+// skipped frames, so playback can start from the state the recording was in.
+class SegmentSource : public FrameSource {
+private:
+    FrameSource* source = nullptr;
+    uint32_t toUs = 0;
+    RecordedFrame start;        // First frame of the segment, as recorded
+    int32_t travelBase = 0;
+    bool startPending = false;
+    bool done = true;
+    MechanismTracker mechanisms;
+
+    void rebase(RecordedFrame& frame) const;
+
+public:
+    // Skip frames to fromMs. Returns false if the recording ends first.
+    bool begin(FrameSource& frames, uint32_t fromMs, uint32_t toMs);
+
+    const RecordedFrame& getStart() const { return start; }
+
+    // Mechanism state at the start of the segment, ready to keep tracking from
+    const MechanismTracker& getMechanisms() const { return mechanisms; }
+
+    bool next(RecordedFrame& frame) override;
+    const RecordingInfo& getInfo() const override { return source->getInfo(); }
+};
+
+// Playback speed for the segment between two frames with drive commands
+// from (counts) and to, dt seconds apart: timeScale, reduced where the
+// scaled commands would pass 127 or change faster than maxAccel counts per
+// second (0 = no limit). Never below real time.
+float scaledSegmentSpeed(const float from[2], const float to[2], float dt, float timeScale, float maxAccel);
+
+// A recording flattened into plain data for the plain open-loop playback
+// path: one command per frame with the time scale baked into its time and
+// sticks, and the mechanism changes as timed events. Playing it is
+// a cursor walk with nothing left to decide per frame.
+class CommandStream {
+private:
+    PlaybackCommand* commands = nullptr;
+    MechanismEvent* events = nullptr;
+    size_t commandCapacity = 0;
+    size_t commandCount = 0;
+    size_t eventCount = 0;
+
+    bool valid = false;
+    float timeScale = 1.0f;     // Settings the stream was compiled with
+    float maxAccel = 0.0f;
+
+public:
+    // Carve room for maxCommands commands and REPLAY_MAX_EVENTS events from the arena
+    bool prepare(size_t maxCommands);
+
+    // Flatten source from its current position. Fails (leaving the stream
+    // invalid) if the recording has more frames or events than fit.
+    bool compile(FrameSource& source, float timeScale, float maxAccel);
+
+    void clear() { valid = false; commandCount = 0; eventCount = 0; }
+
+    // Compiled, and with these playback settings?
+    bool matches(float scale, float accel) const { return valid && scale == timeScale && accel == maxAccel; }
+
+    size_t getCommandCount() const { return commandCount; }
+    size_t getEventCount() const { return eventCount; }
+    const PlaybackCommand& getCommand(size_t index) const { return commands[index]; }
+    const MechanismEvent& getEvent(size_t index) const { return events[index]; }
+
+    // Playback length in milliseconds
+    uint32_t getDurationMs() const { return commandCount > 0 ? commands[commandCount - 1].time / 1000 : 0; }
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include "replay_format.h"
+
+// Nominal motor voltage behind a +-127 move() command
+constexpr float REPLAY_NOMINAL_VOLTS = 12.0f;
+
+// Opcontrol's stick deadband: smaller stick values never reach the drive
+constexpr int REPLAY_STICK_DEADBAND = 8;
+
+// The +-127 command the motors actually got for a recorded command channel's
+// value: sticks go through the deadband, and everything is clamped as move()
+// clamps it. Fits and playback both work from this, not the raw value.
+float appliedCommand(uint8_t channel, int32_t value);
+
+// Least-squares fit of volts = kS * sign(v) + kV * v + kA * a for one actuator.
+//
+// Samples are folded into the 3x3 normal equations as they arrive, so a fit
+// needs no sample storage and can run on the brain straight after recording.
+// Only depends on the format code, so the same fit can be built on a PC and
+// run over recordings copied off the SD card.
+class FeedforwardFit {
+private:
+    double xtx[3][3] = {};
+    double xty[3] = {};
+    uint32_t count = 0;
+
+public:
+    // Fewer samples than this (while moving) gives no model
+    static constexpr uint32_t MIN_SAMPLES = 50;
+
+    void add(float volts, float velocity, float acceleration);
+
+    // Solve for the model. Returns false with too few samples or a degenerate
+    // fit (e.g. the actuator only ever ran at one speed).
+    bool solve(ActuatorModel& model) const;
+
+    uint32_t getCount() const { return count; }
+};
+
+// Voltage the model asks for at a velocity (rpm) and acceleration (rpm/s)
+float feedforwardVolts(const ActuatorModel& model, float velocity, float acceleration);
+
+// Fit a model for every actuator the recording has both a command and a
+// measured velocity channel for (drive sides, intake, outtake), reading every
+// frame from source. Replaces info's models; returns how many were fitted.
+int fitFeedforward(FrameSource& source, RecordingInfo& info);
@@ -0,0 +1,347 @@
+#pragma once
+#include "replay_arena.h"
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Recording file format ("ARPL")
+//
+// Everything is little-endian and byte-packed, independent of struct layout:
+//
+//   FileHeader   (24 bytes, fixed part)
+//   ChannelEntry (v11+: 7 bytes each - id, type, flags (bit 0: second order),
+//                 int32 modulus - so a file decodes the way it was written
+//                 whatever the build registers; v1-v10: id and type only)
+//   ModelEntry   (v7+: uint8_t modelCount, then REPLAY_MAX_MODELS x 13 bytes -
+//                 channel, kS, kV, kA as float32 - always reserved, so fitted
+//                 models can be patched in without moving the blocks)
+//   uint32_t     CRC32 of the header bytes above
+//   Block...     BlockHeader (12 bytes) + payload, repeated until EOF
+//
+// Each block carries up to framesPerBlock frames and its own payload CRC32, so
+// a truncated or corrupt file is rejected before playback commits to it.
+// Files written before this format (a bare uint32_t count followed by raw
+// 24-byte frame structs) are still read through the legacy path.
+//
+// Block payload encodings:
+//   ENC_PACKED - every channel at its packed width, frame after frame (v1)
+//   ENC_DELTA  - per-channel run-length + zig-zag varint deltas (v2):
+//       The first frame of a block stores each channel's absolute value.
+//       After that a channel only appears in the stream when its current run
+//       has ended, as <delta varint><run varint>, where run is the number of
+//       following frames that repeat the same step. "Same step" means
+//       unchanged for normal channels and an unchanged delta for the
+//       timestamp, so a steady 20ms loop costs nothing per frame.
+//   ENC_COLUMNAR - the same tokens as ENC_DELTA, grouped by channel (v3):
+//       for each channel in header order, <column length varint> followed by
+//       that channel's tokens. A channel's whole history for the block is one
+//       contiguous run of bytes, so host-side tools can pull out a single
+//       column without decoding the rest.
+// ---------------------------------------------------------------------------
+
+constexpr uint32_t REPLAY_MAGIC = 0x4C505241;  // "ARPL" when read as bytes
+constexpr uint16_t REPLAY_VERSION = 11;   // Bump whenever a built-in channel ID is added or moved
+
+constexpr size_t REPLAY_FILE_HEADER_SIZE = 24;
+constexpr size_t REPLAY_CHANNEL_ENTRY_SIZE = 7;
+constexpr size_t REPLAY_LEGACY_CHANNEL_ENTRY_SIZE = 2;   // v1-v10, before decode parameters were stored
+constexpr uint8_t REPLAY_MAX_MODELS = 4;
+constexpr size_t REPLAY_MODEL_ENTRY_SIZE = 13;
+constexpr size_t REPLAY_BLOCK_HEADER_SIZE = 12;
+
+constexpr uint16_t REPLAY_FRAMES_PER_BLOCK = 256;  // ~5 seconds at 50Hz
+constexpr uint16_t REPLAY_SAMPLE_PERIOD_MS = 20;   // opcontrol loop period
+constexpr uint8_t REPLAY_MAX_CHANNELS = 24;
+constexpr size_t REPLAY_MAX_BLOCK_PAYLOAD = 4096;   // Larger blocks are split when encoding
+constexpr uint32_t REPLAY_BATTERY_PERIOD_MS = 500;  // Battery channel is re-read this often and held in between
+
+// Channel IDs stored in the header channel list. IDs are below REPLAY_MAX_CHANNELS;
+// CH_USER_FIRST and up are free for mechanisms registered at startup. Adding
+// or moving a built-in ID changes what old files mean - bump REPLAY_VERSION.
+enum ReplayChannel : uint8_t {
+    CH_TIMESTAMP = 0,   // Microseconds since recording start
+    CH_LEFT_STICK = 1,
+    CH_RIGHT_STICK = 2,
+    CH_INTAKE = 3,
+    CH_OUTTAKE = 4,
+    CH_HEADING = 5,     // Centidegrees (0 - 35999)
+    CH_BUTTONS = 6,     // Digital inputs, one bit each (BTN_* in replay_commands.h)
+    CH_POSE_X = 7,      // Odometry position, hundredths of an inch from the recording start
+    CH_POSE_Y = 8,
+    CH_LEFT_VEL = 9,    // Measured velocities, tenths of an rpm (drive sides averaged over the group)
+    CH_RIGHT_VEL = 10,
+    CH_INTAKE_VEL = 11,
+    CH_OUTTAKE_VEL = 12,
+    CH_BATTERY = 13,    // Battery voltage in millivolts, re-read every REPLAY_BATTERY_PERIOD_MS
+    CH_MECHANISMS = 14, // Mechanism state machine state, one bit each (MECH_STATE_* in replay_commands.h)
+    CH_TRAVEL = 15,     // Path length rolled by the tracking wheel (either direction), hundredths of an inch
+    CH_CHECKPOINT = 16, // Non-zero on frames marked as checkpoints (CHECKPOINT_* in replay_tracking.h)
+    CH_USER_FIRST = 17
+};
+
+// On-disk value types (determines packed width)
+enum ChannelType : uint8_t {
+    CHT_U8 = 0,
+    CHT_I8 = 1,
+    CHT_U16 = 2,
+    CHT_I16 = 3,
+    CHT_U32 = 4,
+    CHT_I32 = 5
+};
+
+// One frame of recorded data, as a row of raw channel values. Only used one
+// frame at a time on the way in and out - recordings themselves are stored
+// column by column (ColumnBlock, ENC_COLUMNAR). What each channel means, and
+// its scale, comes from the channel registry (replay_channels.h).
+struct RecordedFrame {
+    uint32_t timestamp = 0;                     // Microseconds since recording start (CH_TIMESTAMP)
+    int32_t values[REPLAY_MAX_CHANNELS] = {};   // Raw value of every other channel, indexed by channel ID
+
+    int32_t get(uint8_t id) const { return values[id]; }
+    void set(uint8_t id, int32_t value) { values[id] = value; }
+};
+
+// Header flags
+constexpr uint8_t REPLAY_FLAG_STREAMING = 0x01;  // Written while recording; header not finalized yet
+constexpr uint8_t REPLAY_FLAG_CHANGES = 0x02;    // Change-only recording: frames are sparse, values hold until the next one
+
+// Block payload encodings
+enum BlockEncoding : uint8_t {
+    ENC_PACKED = 0,
+    ENC_DELTA = 1,
+    ENC_COLUMNAR = 2
+};
+
+struct ChannelEntry {
+    uint8_t id;
+    uint8_t type;
+    int32_t modulus;            // Decode parameters, as in ChannelDef
+    bool secondOrder;
+};
+
+// Feedforward model of one actuator, fitted from the recording itself:
+// volts = kS * sign(v) + kV * v + kA * a, with v in rpm and a in rpm/s
+struct ActuatorModel {
+    uint8_t channel = 0;        // Velocity channel it describes (CH_LEFT_VEL, ...)
+    float kS = 0.0f;
+    float kV = 0.0f;
+    float kA = 0.0f;
+};
+
+// Parsed form of the file header
+struct RecordingInfo {
+    uint16_t version = REPLAY_VERSION;
+    uint16_t samplePeriodMs = REPLAY_SAMPLE_PERIOD_MS;
+    uint16_t framesPerBlock = REPLAY_FRAMES_PER_BLOCK;
+    uint32_t frameCount = 0;
+    uint32_t durationMs = 0;
+    uint8_t flags = 0;
+    uint8_t channelCount = 0;
+    uint16_t batteryMv = 0;     // Battery voltage when recording started (0 = not recorded)
+    ChannelEntry channels[REPLAY_MAX_CHANNELS] = {};
+    uint8_t modelCount = 0;
+    ActuatorModel models[REPLAY_MAX_MODELS];
+};
+
+// The recording's model for a velocity channel, or nullptr if it has none
+const ActuatorModel* findModel(const RecordingInfo& info, uint8_t channel);
+
+// A recording held in RAM: parsed header plus the encoded blocks exactly as
+// they sit on disk (BlockHeader + payload, back to back). Frames are decoded
+// on the fly with RecordingReader, so a recording costs a few bytes per frame.
+// blocks lives in the replay arena - reserve() it once before use.
+struct EncodedRecording {
+    RecordingInfo info;
+    ByteBuffer blocks;
+
+    void clear();
+    bool empty() const { return info.frameCount == 0; }
+};
+
+// Little-endian field helpers shared by the recording and index formats
+void putLE16(std::vector<uint8_t>& out, uint16_t v);
+void putLE32(std::vector<uint8_t>& out, uint32_t v);
+void putLE16(uint8_t* p, uint16_t v);   // Into a fixed-size record
+void putLE32(uint8_t* p, uint32_t v);
+uint16_t getLE16(const uint8_t* p);
+uint32_t getLE32(const uint8_t* p);
+
+// CRC32 (IEEE 802.3, reflected) - pass the previous result to continue a running CRC
+uint32_t replayCrc32(const uint8_t* data, size_t length, uint32_t crc = 0);
+
+// Fill info with the channel list this build records (from the channel registry)
+void initRecordingInfo(RecordingInfo& info);
+
+// Does the recording's channel list include id?
+bool hasChannel(const RecordingInfo& info, uint8_t id);
+
+// Width in bytes of a channel type, or 0 if unknown
+size_t channelTypeSize(uint8_t type);
+
+// Size in bytes of one packed frame for the given channel list
+size_t packedFrameSize(const RecordingInfo& info);
+
+// Serialize the header (including channel list and CRC) into out
+void writeRecordingHeader(const RecordingInfo& info, std::vector<uint8_t>& out);
+
+// One block's worth of frames held column by column: a tightly packed
+// little-endian array per channel, each at its on-disk width.
+class ColumnBlock {
+private:
+    const RecordingInfo* info = nullptr;
+    uint8_t* storage = nullptr;                  // Carved from the replay arena
+    size_t storageSize = 0;
+    uint32_t offsets[REPLAY_MAX_CHANNELS] = {};  // Start of each column in storage
+    uint16_t capacity = 0;
+    uint16_t count = 0;
+
+public:
+    // Lay out the columns for info's channel list. Storage is carved from the
+    // arena the first time (or if the channel list grew) and reused after
+    // that - push() never allocates.
+    bool init(const RecordingInfo& info, uint16_t capacity = REPLAY_FRAMES_PER_BLOCK);
+
+    // Append a frame (false if the block is full)
+    bool push(const RecordedFrame& frame);
+
+    void clear() { count = 0; }
+    uint16_t size() const { return count; }
+    bool full() const { return count >= capacity; }
+
+    // Raw value of channel column (index into info.channels) for frame index
+    int32_t value(uint8_t column, uint16_t index) const;
+
+    // Rebuild one frame as a row
+    void getFrame(uint16_t index, RecordedFrame& frame) const;
+
+    // A column's packed values, for analysis
+    const uint8_t* columnData(uint8_t column) const { return storage + offsets[column]; }
+};
+
+// Encode a block of frames (header + payload) appended to out.
+// Splits into several blocks if the payload would exceed REPLAY_MAX_BLOCK_PAYLOAD,
+// and falls back to ENC_PACKED for any block that delta coding would make bigger.
+// Returns false (with out unchanged) if out doesn't have room.
+bool encodeBlock(const RecordingInfo& info, const ColumnBlock& block,
+                 ByteBuffer& out, uint8_t encoding = ENC_COLUMNAR);
+
+// Check a block header read from a file against info before its payload is
+// trusted: frame count within framesPerBlock, a known encoding, and a payload
+// size that fits REPLAY_MAX_BLOCK_PAYLOAD (exactly, for ENC_PACKED)
+bool checkBlockHeader(const RecordingInfo& info, const uint8_t* header);
+
+// Most bytes frames can take once encoded (blocks only, no file header), however
+// they are split into blocks. Size RAM buffers with this to guarantee a length fits.
+size_t worstCaseBlocksSize(const RecordingInfo& info, uint32_t frames);
+
+// worstCaseBlocksSize() for REPLAY_GUARANTEED_MS of recording at info's sample period
+size_t guaranteedBlocksSize(const RecordingInfo& info);
+
+// Collects frames as they are recorded and encodes a block every framesPerBlock frames
+class RecordingEncoder {
+private:
+    EncodedRecording* target = nullptr;
+    ColumnBlock pending;
+    uint32_t encodedDurationMs = 0;
+
+    bool flushPending();
+
+public:
+    // Carve the block buffer from the arena (once, ahead of recording)
+    bool prepare();
+
+    // Reset target and start a new recording into it, with extra header flags
+    // (e.g. REPLAY_FLAG_CHANGES) and the starting battery voltage. Returns false
+    // if the block buffer couldn't be allocated.
+    bool begin(EncodedRecording& recording, uint8_t flags = 0, uint16_t batteryMv = 0);
+
+    // Add a frame. Returns false if the encoded block couldn't be stored (out of memory).
+    bool addFrame(const RecordedFrame& frame);
+
+    // Encode whatever is left in the pending block
+    bool finish();
+};
+
+// Anything playback can pull decoded frames from, in order
+class FrameSource {
+public:
+    virtual ~FrameSource() = default;
+
+    // Decode the next frame. Returns false once there are no more frames.
+    virtual bool next(RecordedFrame& frame) = 0;
+
+    // Header of the recording being played (sample period, flags, channels)
+    virtual const RecordingInfo& getInfo() const = 0;
+};
+
+// Decodes frames one at a time from a buffer of encoded blocks.
+// Cheap enough to run in-line in the playback loop.
+class RecordingReader : public FrameSource {
+private:
+    const RecordingInfo* info;
+    const uint8_t* data;
+    size_t size;
+    size_t offset = 0;
+
+    // Current block
+    const uint8_t* cursor = nullptr;
+    const uint8_t* blockEnd = nullptr;
+    uint16_t blockFrames = 0;
+    uint16_t frameInBlock = 0;
+    uint8_t encoding = ENC_PACKED;
+
+    // Per-column read positions (ENC_COLUMNAR)
+    const uint8_t* columnCursor[REPLAY_MAX_CHANNELS] = {};
+    const uint8_t* columnEnd[REPLAY_MAX_CHANNELS] = {};
+
+    // Per-channel decoder state (indexed like info->channels)
+    int32_t values[REPLAY_MAX_CHANNELS] = {};
+    int32_t deltas[REPLAY_MAX_CHANNELS] = {};
+    uint16_t runs[REPLAY_MAX_CHANNELS] = {};
+
+    bool openNextBlock();
+
+public:
+    RecordingReader(const RecordingInfo& info, const uint8_t* data, size_t size);
+    explicit RecordingReader(const EncodedRecording& recording)
+        : RecordingReader(recording.info, recording.blocks.data(), recording.blocks.size()) {}
+
+    // Decode the next frame. Returns false at the end of the data (or on a malformed block).
+    bool next(RecordedFrame& frame) override;
+
+    const RecordingInfo& getInfo() const override { return *info; }
+
+    // Start again from the first frame
+    void rewind();
+};
+
+// Write a whole recording (header + blocks) to an open file
+bool writeRecording(FILE* file, const EncodedRecording& recording);
+
+// Rewrite the header of the finished recording at path in place, e.g. to add
+// fitted models. Fails unless the new header is exactly the size of the old one.
+bool updateRecordingHeader(const char* path, const RecordingInfo& info);
+
+// Read and validate just the header, leaving the file at the first block.
+// Fails for legacy files, and for streamed files that were never finalized
+// unless allowUnfinished is set (crash recovery).
+bool readRecordingInfo(FILE* file, RecordingInfo& info, bool allowUnfinished = false);
+
+// Read a whole recording from an open file, new format or legacy, into
+// recording.blocks (reserving it from the arena if it's too small). Fails for
+// a file that doesn't validate (including a streamed file whose header was
+// never finalized) or doesn't fit. The whole file is checked before recording
+// is touched, so it is left as it was then - only a read error after that
+// leaves it empty. Legacy files need prepareLegacyRead() to have been called.
+bool readRecording(FILE* file, EncodedRecording& recording);
+
+// Carve the encoder legacy files are re-encoded through from the arena (once, at startup)
+bool prepareLegacyRead();
+
+// Validate a whole recording that is already in memory (e.g. linked into the
+// program) and point blocks at its encoded blocks, without copying anything.
+// Pair with RecordingReader(info, blocks, blocksSize) for zero-copy playback.
+bool openRecordingBuffer(const uint8_t* data, size_t size, RecordingInfo& info,
+                         const uint8_t*& blocks, size_t& blocksSize);
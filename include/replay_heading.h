@@ -0,0 +1,67 @@
+#pragma once
+#include "main.h"
+#include "replay_tracking.h"
+#include <atomic>
+
+// How often the heading controller reads the IMU and refreshes the drive
+constexpr uint32_t REPLAY_HEADING_PERIOD_MS = 5;
+
+// How the drive counts (+-127) go out to the motors
+enum class DriveOutput : uint8_t {
+    MOVE,       // move(): open loop
+    VELOCITY,   // move_velocity(): share of the gearset's top speed
+    VOLTAGE     // move_voltage(): share of 12 V
+};
+
+// Holds the recorded heading from its own fixed-rate task.
+//
+// Playback only posts the heading it wants and the base drive commands; the
+// task runs a HeadingPID on the IMU's continuous rotation and gyro rate every
+// REPLAY_HEADING_PERIOD_MS and sends base + correction to the drive, so
+// correction neither waits for nor depends on the recording's frame spacing.
+// The drive motors belong to the task between start() and stop().
+class HeadingController {
+private:
+    HeadingPID pid;
+    DriveOutput output = DriveOutput::MOVE;
+    float maxRpm = 600.0f;
+
+    pros::Mutex commandLock;        // Guards the posted command below
+    float targetHeading = 0.0f;     // Continuous (unwrapped), degrees from the start
+    float baseLeft = 0.0f;
+    float baseRight = 0.0f;
+    bool posted = false;            // Nothing is driven until the first post()
+
+    float startRotation = 0.0f;     // IMU rotation that lines up with the recording's 0
+    float maxError = 0.0f;
+
+    std::atomic<bool> stopRequested{false};
+    std::atomic<bool> taskRunning{false};
+
+    void launch();
+    void controlTask();
+    void drive(float left, float right);
+
+public:
+    void setGains(HeadingGains gains) { pid.setGains(gains); }
+    const HeadingGains& getGains() const { return pid.getGains(); }
+
+    // Take over the drive. maxRpm is the gearset's top speed for VELOCITY output.
+    // startHeading is the robot's heading now in the recording's terms (degrees).
+    void start(DriveOutput mode, float maxRpm, float startHeading = 0.0f);
+
+    // Hold compassHeading (0-360, as recorded) while driving left/right (counts)
+    void post(float compassHeading, float left, float right);
+
+    // Stop the task and hand the drive back (motors are left at their last command)
+    void stop();
+
+    // Take the drive back after a stop() without moving the heading reference,
+    // so targets still line up with the recording. Waits for the next post().
+    void resume();
+
+    bool isRunning() const { return taskRunning; }
+
+    // Largest heading error seen since start() (degrees)
+    float getMaxError() const { return maxError; }
+};
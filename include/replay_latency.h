@@ -0,0 +1,88 @@
+#pragma once
+#include "replay_format.h"
+#include <cstdint>
+#include <cstddef>
+
+// Where measured latencies are kept on the SD card
+constexpr const char* REPLAY_LATENCY_PATH = "/usd/replay_latency.bin";
+
+// Pistons have no position feedback to time, so their lead is this
+// actuation time unless set otherwise (AutonReplay::setPistonLatency)
+constexpr uint16_t REPLAY_PISTON_LATENCY_MS = 50;
+
+// Actuators with their own command-to-motion latency
+enum LatencyActuator : uint8_t {
+    LAT_DRIVE = 0,
+    LAT_INTAKE = 1,
+    LAT_OUTTAKE = 2,
+    LAT_MID_SCORING = 3,    // Pistons
+    LAT_DESCORE = 4,
+    LAT_UNLOADER = 5,
+    LAT_COUNT = 6
+};
+
+// Measured command-to-motion latency of each actuator (milliseconds)
+struct LatencyTable {
+    uint16_t ms[LAT_COUNT] = {};
+};
+
+// Read/write the table (magic, version, count, values, CRC32). Loading
+// fails, leaving table untouched, for a missing or bad file.
+bool loadLatencyTable(const char* path, LatencyTable& table);
+bool saveLatencyTable(const char* path, const LatencyTable& table);
+
+// Frames read ahead of the playback position
+constexpr uint8_t REPLAY_LEAD_WINDOW = 32;
+constexpr uint8_t REPLAY_MAX_LEAD_LANES = 16;
+
+// Plays some channels early.
+//
+// Wraps a FrameSource and gives each lane (a channel, or some bits of one)
+// the value it will have leadUs later in the recording, so a command goes
+// out that much before it was recorded and the hardware moves when it did.
+// Channels without a lane play as recorded. An extra frame is inserted
+// wherever a lane changes between the source's frames, so a change lands at
+// exactly its recorded time minus the lead, sparse recordings included.
+// Leads are not capped, but a lane only sees REPLAY_LEAD_WINDOW frames ahead:
+// a change further off than that goes out as soon as it comes into the
+// window, and never earlier than the last frame handed out, so timestamps
+// stay in order whatever the lead.
+class LeadSource : public FrameSource {
+private:
+    struct Lane {
+        uint8_t channel;
+        int32_t mask;
+        uint32_t leadUs;
+        uint32_t pos;           // Window index (absolute) of the frame it reads
+    };
+
+    FrameSource* source = nullptr;
+    Lane lanes[REPLAY_MAX_LEAD_LANES];
+    uint8_t laneCount = 0;
+
+    RecordedFrame window[REPLAY_LEAD_WINDOW];
+    uint32_t windowStart = 0;   // Absolute index of the oldest buffered frame
+    uint32_t windowCount = 0;
+    bool exhausted = false;
+
+    uint32_t basePos = 0;       // Frame the lead-free channels come from
+    uint32_t time = 0;          // Timestamp of the last frame handed out
+    bool started = false;
+
+    const RecordedFrame& at(uint32_t pos) const { return window[pos % REPLAY_LEAD_WINDOW]; }
+    bool sameValue(const Lane& lane, uint32_t a, uint32_t b) const;
+    void fill();
+    void advance();
+
+public:
+    // Start over on a new source, with no lanes
+    void attach(FrameSource& frames);
+
+    // Play channel's masked bits leadUs early. A zero lead is ignored.
+    bool addLane(uint8_t channel, int32_t mask, uint32_t leadUs);
+
+    uint8_t getLaneCount() const { return laneCount; }
+
+    bool next(RecordedFrame& frame) override;
+    const RecordingInfo& getInfo() const override { return source->getInfo(); }
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include "replay_format.h"
+#include "lemlib/asset.hpp"
+#include <cstdint>
+#include <cstddef>
+
+// Recording embedded in the cold package from recordings/<x>.bin by
+// firmware/replay-asset.mk. Declared weak, so a missing file leaves an empty
+// asset (buf == nullptr) instead of breaking the link.
+#define REPLAY_ASSET(x)                                                                                                \
+    extern "C" {                                                                                                       \
+    extern uint8_t _binary_recordings_##x##_bin_start[] __attribute__((weak));                                         \
+    extern uint8_t _binary_recordings_##x##_bin_size[] __attribute__((weak));                                          \
+    static asset x = {_binary_recordings_##x##_bin_start, (size_t)_binary_recordings_##x##_bin_size};                  \
+    }
+
+// Number of recording slots. The first four line up with autonNames /
+// autonSelection in robot_config.cpp, the rest are spare practice slots.
+constexpr int REPLAY_SLOT_COUNT = 8;
+
+// Compact per-slot summary kept in the SD card index
+struct SlotEntry {
+    uint32_t frameCount = 0;
+    uint32_t durationMs = 0;
+    uint32_t fileSize = 0;      // Bytes on the SD card
+    uint32_t checksum = 0;      // CRC32 of the file's block bytes (everything after the header)
+};
+
+// A validated recording linked into the program - played in place, never copied
+struct EmbeddedRecording {
+    RecordingInfo info;
+    const uint8_t* blocks = nullptr;
+    size_t size = 0;
+};
+
+// Named recording slots with one small index file on the SD card, so menus and
+// the pre-match preload never have to open and parse every recording
+class ReplayLibrary {
+private:
+    SlotEntry entries[REPLAY_SLOT_COUNT];
+    EmbeddedRecording embedded[REPLAY_SLOT_COUNT];
+
+    bool loadIndex();
+    void rebuildIndex();
+
+public:
+    // Recover any interrupted recordings, then read the index from the SD card
+    // (rebuilding it from the slot files if it's missing, bad or stale).
+    // Returns the number of recordings recovered.
+    int init();
+
+    // Write the index back to the SD card
+    bool saveIndex();
+
+    // Record a new summary for a slot and save the index
+    void updateSlot(int slot, const SlotEntry& entry);
+
+    // Forget a slot's recording (index only - the file is left alone)
+    void clearSlot(int slot);
+
+    const SlotEntry& getEntry(int slot) const { return entries[slot]; }
+    bool hasRecording(int slot) const { return entries[slot].frameCount > 0; }
+
+    // Attach an embedded recording to a slot. Checks the header and every block
+    // CRC once here, so playback can trust it. Returns false for a missing or bad asset.
+    bool embed(int slot, const asset& recording);
+    bool hasEmbedded(int slot) const { return isValidSlot(slot) && embedded[slot].blocks != nullptr; }
+    const EmbeddedRecording& getEmbedded(int slot) const { return embedded[slot]; }
+
+    static bool isValidSlot(int slot) { return slot >= 0 && slot < REPLAY_SLOT_COUNT; }
+    static const char* getSlotName(int slot);
+    static const char* getSlotPath(int slot);
+};
+
+// Global instance
+extern ReplayLibrary replayLibrary;
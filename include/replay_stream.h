@@ -0,0 +1,158 @@
+#pragma once
+#include "replay_format.h"
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// A block is handed to the flush task at least this often, so a brownout or
+// program stop mid-recording loses at most about this much driving
+constexpr uint32_t REPLAY_CHECKPOINT_MS = 1000;
+
+// Recordings are written to "<path>.part" and only moved to path once complete
+std::string replayPartPath(const char* path);
+
+// Where commitRecording() keeps the previous recording while the new one moves in
+std::string replayBackupPath(const char* path);
+
+// Move a finished part file into place. The old recording is renamed to its
+// backup path first and only deleted once the new one is at path, so a
+// brownout at any point leaves one of them (see restoreBackup()). Uses
+// rename() where the filesystem supports it, otherwise copies the validated
+// blocks across - the part file is only discarded once the copy is complete,
+// so a crash part way through is picked up again by recoverRecording().
+bool commitRecording(const char* partPath, const char* path);
+
+// Finish a commit a brownout interrupted: put the backup back if nothing made
+// it to path, or drop it if the new recording did. Returns true if it restored one.
+bool restoreBackup(const char* path);
+
+// Carve recoverRecording()'s block buffer from the arena (once, at startup)
+bool prepareRecovery();
+
+// Rebuild a finalized recording at path from whatever valid blocks a part
+// file holds (e.g. after a brownout mid-recording). Stops at the first torn
+// or corrupt block. path is left untouched if there's nothing to recover.
+// Needs prepareRecovery() to have been called.
+bool recoverRecording(const char* partPath, const char* path, RecordingInfo* recovered = nullptr);
+
+// Remove a part file (or empty it if the filesystem can't delete)
+void discardPartFile(const char* partPath);
+
+// Streams a recording to the SD card while it is being recorded.
+//
+// Frames go into one of two fixed block buffers. When one fills up (or every
+// REPLAY_CHECKPOINT_MS) the recorder switches to the other and a low priority
+// background task encodes the full one, appends it to the part file and
+// flushes it. RAM use is fixed no matter how long the recording is, and
+// stopping only has to write the last partial block, patch the header and
+// commit the part file over the old recording.
+class ReplayStreamWriter {
+private:
+    FILE* file = nullptr;
+    std::string targetPath;
+    std::string partPath;
+    RecordingInfo info;                 // Written frames only - finalized into the header on finish()
+
+    ColumnBlock buffers[2];             // Sized once in begin()
+    uint8_t activeBuffer = 0;           // Buffer the recorder is filling
+    uint8_t writeBuffer = 0;            // Next buffer the task will write
+    std::atomic<bool> bufferFull[2] = {false, false};
+
+    std::atomic<bool> stopRequested{false};
+    std::atomic<bool> taskRunning{false};
+    std::atomic<bool> writeFailed{false};
+
+    uint32_t acceptedFrames = 0;
+    uint32_t droppedFrames = 0;
+    uint32_t lastTimestamp = 0;
+    uint32_t blockStartTimestamp = 0;   // First frame of the block being filled
+    uint32_t blocksCrc = 0;             // Running CRC32 over all block bytes written
+    uint32_t fileSize = 0;
+    uint32_t headerSize = 0;
+
+    ByteBuffer blockBuffer;             // Encode buffer, only touched by the flush task
+
+    bool swapBuffers();
+    void flushTask();
+    bool writeBlock(uint8_t index);
+    bool writeHeader();
+
+public:
+    // Carve the block and encode buffers from the arena (once, ahead of recording)
+    bool prepare();
+
+    // Open path's part file, write a provisional header and start the flush task.
+    // The previous recording at path is untouched until finish() commits.
+    // flags are extra header flags (e.g. REPLAY_FLAG_CHANGES), batteryMv the
+    // starting battery voltage for the header.
+    bool begin(const char* path, uint8_t flags = 0, uint16_t batteryMv = 0);
+
+    // Queue a frame. Never blocks and never allocates; returns false if the
+    // frame had to be dropped because the SD card fell a whole block behind.
+    bool addFrame(const RecordedFrame& frame);
+
+    // Flush the tail, finalize the header and commit the part file to path
+    bool finish();
+
+    // Stop without committing: the part file is discarded and path is left as it was
+    void abort();
+
+    bool isActive() const { return file != nullptr; }
+    uint32_t getFrameCount() const { return acceptedFrames; }
+    uint32_t getDurationMs() const { return lastTimestamp / 1000; }
+    uint32_t getDroppedFrames() const { return droppedFrames; }
+
+    // Valid after finish(): CRC32 of everything after the header, and total file size
+    uint32_t getChecksum() const { return blocksCrc; }
+    uint32_t getFileSize() const { return fileSize; }
+};
+
+// Plays a recording straight off the SD card with bounded memory.
+//
+// A prefetch task reads whole CRC-checked blocks into a small ring of fixed
+// slots ahead of the playback cursor; next() decodes out of the ring and
+// hands each slot back once it has been played. Peak RAM is the ring itself,
+// whatever the recording length.
+class ReplayStreamReader : public FrameSource {
+private:
+    static constexpr uint8_t SLOT_COUNT = 3;
+    static constexpr size_t SLOT_SIZE = REPLAY_BLOCK_HEADER_SIZE + REPLAY_MAX_BLOCK_PAYLOAD;
+
+    FILE* file = nullptr;
+    RecordingInfo info;
+
+    uint8_t slots[SLOT_COUNT][SLOT_SIZE];
+    uint16_t slotSizes[SLOT_COUNT] = {};
+    std::atomic<bool> slotReady[SLOT_COUNT] = {false, false, false};
+    uint8_t fillSlot = 0;               // Next slot the prefetch task loads
+    uint8_t playSlot = 0;               // Slot currently being decoded
+
+    RecordingReader blockReader{info, nullptr, 0};
+    bool blockOpen = false;
+
+    std::atomic<bool> stopRequested{false};
+    std::atomic<bool> taskRunning{false};
+    std::atomic<bool> endOfFile{false};
+    std::atomic<bool> readFailed{false};
+    uint32_t underruns = 0;
+
+    void prefetchTask();
+    bool readBlock(uint8_t slot);
+
+public:
+    // Open path, validate the header and start prefetching. Fails for legacy
+    // files, which have to be loaded into RAM instead.
+    bool open(const char* path);
+
+    // Next frame from the ring. Only waits if the SD card fell behind (counted as an underrun).
+    bool next(RecordedFrame& frame) override;
+
+    // Stop the prefetch task and close the file
+    void close();
+
+    bool isOpen() const { return file != nullptr; }
+    bool hasFailed() const { return readFailed; }
+    const RecordingInfo& getInfo() const override { return info; }
+    uint32_t getUnderruns() const { return underruns; }
+};
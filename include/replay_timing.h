@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Default period of the playback scheduler. The drive, heading correction and
+// emergency stop are serviced at least this often; frames are additionally
+// woken for on their own deadlines in between.
+constexpr uint32_t REPLAY_PLAYBACK_PERIOD_MS = 10;
+
+// What playback does with frames that fell due while it was asleep longer
+// than planned (screen drawing, a higher priority task, a slow SD read)
+enum class CatchUpPolicy : uint8_t {
+    STRICT,     // Send every overdue frame in order, as recorded
+    COALESCE,   // Send only the newest overdue frame, but still fire every button edge
+    TIME_SHIFT  // Push the rest of the timeline back by the lateness and play on from there
+};
+
+// Distance-indexed playback: segments recorded slower than this (inches per
+// second) are stationary and play by time instead
+constexpr float REPLAY_DISTANCE_MIN_SPEED = 2.0f;
+
+// ...and the distance timeline never falls further than this behind the
+// clock, so a robot that is pinned or stuck still plays on (milliseconds)
+constexpr uint32_t REPLAY_DISTANCE_MAX_LAG_MS = 750;
+
+// Recording time (microseconds) that puts the robot's travelled distance on
+// the segment between two frames, from (fromTime, fromTravel) to (toTime,
+// toTravel), travel in inches. Clamped to the segment. Returns false for a
+// stationary segment, where distance says nothing about time.
+bool distanceToTime(uint32_t fromTime, float fromTravel, uint32_t toTime, float toTravel, float travelled,
+                    uint64_t& time);
+
+// Lateness of each played frame (how long after its recorded timestamp it was
+// actually sent to the motors). Kept as a fixed histogram so recording a
+// sample never allocates, and p99 comes out without storing every sample.
+class TimingStats {
+private:
+    static constexpr uint32_t BUCKET_US = 100;      // Histogram resolution
+    static constexpr size_t BUCKET_COUNT = 200;     // 0-20 ms; anything later lands in the last bucket
+
+    uint32_t buckets[BUCKET_COUNT] = {};
+    uint32_t count = 0;
+    uint32_t minUs = 0;
+    uint32_t maxUs = 0;
+    uint64_t totalUs = 0;
+
+public:
+    void reset();
+    void add(uint32_t latenessUs);
+
+    uint32_t getCount() const { return count; }
+    uint32_t getMinUs() const { return minUs; }
+    uint32_t getMaxUs() const { return maxUs; }
+    uint32_t getMeanUs() const { return count > 0 ? static_cast<uint32_t>(totalUs / count) : 0; }
+
+    // Upper edge of the bucket holding the 99th percentile (resolution BUCKET_US, capped at max)
+    uint32_t getP99Us() const;
+};
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstdint>
+
+// Field pose in standard position: inches, and radians counter-clockwise from +x
+// (what chassis.getPose(true, true) returns)
+struct TrackPose {
+    float x = 0.0f;
+    float y = 0.0f;
+    float theta = 0.0f;
+};
+
+// CH_CHECKPOINT values: marked by the driver, or found at a stop
+constexpr uint8_t CHECKPOINT_MARKED = 1;
+constexpr uint8_t CHECKPOINT_STOP = 2;
+
+// Checkpoints: recording marks one where the drive has stood still (below
+// REPLAY_CHECKPOINT_STILL_RPM) this long after moving
+constexpr uint32_t REPLAY_CHECKPOINT_STOP_MS = 300;
+constexpr float REPLAY_CHECKPOINT_STILL_RPM = 5.0f;
+
+// Playback re-syncs at a checkpoint when odometry is further than this from
+// the recorded pose (inches, degrees), giving the correction move this long
+constexpr float REPLAY_RESYNC_DISTANCE = 2.0f;
+constexpr float REPLAY_RESYNC_HEADING = 5.0f;
+constexpr uint32_t REPLAY_RESYNC_TIMEOUT_MS = 1500;
+
+// RAMSETE gains in their usual metric form. b (> 0) acts like a proportional
+// gain on position error, zeta (0 - 1) is the damping. 2.0 / 0.7 is the
+// standard starting point; raise b to pull back onto the path harder.
+struct RamseteGains {
+    float b = 2.0f;
+    float zeta = 0.7f;
+};
+
+// Wrap an angle into (-pi, pi]
+float wrapRadians(float angle);
+
+// RAMSETE trajectory tracker for a differential drive.
+//
+// Given the pose the robot should be at, how fast that reference is moving,
+// and where odometry says the robot actually is, returns the body velocities
+// that follow the reference and pull the robot back onto it. With zero error
+// the output is exactly the reference velocity, so it composes with a
+// feedforward that already produces that motion.
+class RamseteTracker {
+private:
+    RamseteGains gains;
+
+public:
+    explicit RamseteTracker(RamseteGains gains = RamseteGains()) : gains(gains) {}
+
+    void setGains(RamseteGains newGains) { gains = newGains; }
+
+    // targetV in inches/s, targetOmega in rad/s. Outputs in the same units.
+    void compute(const TrackPose& target, float targetV, float targetOmega, const TrackPose& actual,
+                 float& v, float& omega) const;
+};
+
+// Heading PID gains, in stick counts. Defaults match the old fixed P
+// correction (2 counts per degree, +-30) with light damping added.
+struct HeadingGains {
+    float kP = 2.0f;                // Counts per degree of error
+    float kI = 0.5f;                // Counts per degree-second of error
+    float kD = 0.05f;               // Counts per degree/s of turn rate (damping)
+    float integralLimit = 10.0f;    // Most the integral term may contribute
+    float maxCorrection = 30.0f;    // Output clamp
+    float highSpeedScale = 0.6f;    // kP/kI multiplier at full forward speed (linear from 1 at rest)
+};
+
+// Nearest continuous angle to reference (degrees) with the same compass heading
+float unwrapDegrees(float heading, float reference);
+
+// PID on continuous heading error for a differential drive.
+//
+// Damping comes from the measured turn rate rather than the derivative of the
+// error, so target steps don't kick. Proportional and integral gains shrink
+// towards highSpeedScale as forward speed rises, where the same differential
+// correction swings the robot sideways much harder. The integral only
+// accumulates while the output isn't saturated in the same direction, and is
+// clamped on top of that.
+class HeadingPID {
+private:
+    HeadingGains gains;
+    float integral = 0.0f;      // Integral term, already in counts
+
+public:
+    explicit HeadingPID(HeadingGains gains = HeadingGains()) : gains(gains) {}
+
+    void setGains(HeadingGains newGains) { gains = newGains; }
+    const HeadingGains& getGains() const { return gains; }
+    void reset() { integral = 0.0f; }
+
+    // error = target - actual (degrees), rate = d(actual)/dt (degrees/s),
+    // forward = average drive command (counts), dt in seconds. Returns the
+    // correction in counts.
+    float compute(float error, float rate, float forward, float dt);
+};
@@ -37,6 +37,8 @@ extern uint32_t lockTimer;
 
 void drawAutonSelector();
 void drawLockScreen();
-void handleScreenTouch();
-void runAutonSelector(uint32_t timeout_ms);
+bool handleScreenTouch();  // Returns true if the selection changed
+
+// onSelect (optional) is called with the initial selection and again on every change
+void runAutonSelector(uint32_t timeout_ms, void (*onSelect)(int) = nullptr);
 void checkAndLockSelector(uint32_t lockDelay);
\ No newline at end of file
@@ -18,4 +18,15 @@ public:
     void update();
     int getPower();
     bool isMidScoring();
+    bool isUnjamActive();
+
+    // Enter (piston + unjam pulse) or exit mid-scoring, as pressing X does
+    void setMidScoring(bool enabled);
+
+    // Run the unjam pulse while it lasts. Returns true while it owns the motors.
+    bool runUnjam();
+
+    // Drive intake/outtake for mid-scoring without reading the controller (playback).
+    // Returns true while unjam or mid-scoring owns the motors.
+    bool runMidScoring();
 };
\ No newline at end of file
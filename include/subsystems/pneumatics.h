@@ -12,4 +12,8 @@ public:
     void update();
     bool getDescoreState();
     bool getUnloaderState();
+
+    // Set the pistons directly (playback), keeping the toggle state in step
+    void setDescore(bool state);
+    void setUnloader(bool state);
 };
\ No newline at end of file
@@ -1,7 +1,12 @@
 #include "auton_replay.h"
+#include "replay_format.h"
+#include "replay_stream.h"
+#include "replay_library.h"
+#include "replay_channels.h"
 #include "robot_config.h"
 #include <cstdio>
 #include <cmath>
+#include <algorithm>
 
 // Global instance
 AutonReplay autonReplay;
@@ -19,9 +24,109 @@ static uint8_t packButtons() {
     return buttons;
 }
 
-// Helper to check if a button was just pressed (edge detection)
-static bool wasPressed(uint8_t current, uint8_t prev, uint8_t bit) {
-    return (current & (1 << bit)) && !(prev & (1 << bit));
+// Average measured velocity of a motor group (rpm). Indexed one motor at a
+// time - get_actual_velocity_all() would allocate every frame.
+static float averageVelocity(const pros::MotorGroup& motors) {
+    int count = motors.size();
+    if (count <= 0) return 0.0f;
+    
+    double total = 0;
+    for (int i = 0; i < count; i++) {
+        total += motors.get_actual_velocity(i);
+    }
+    return static_cast<float>(total / count);
+}
+
+// Round a scaled motor power and clamp it to the valid range
+static int32_t clampPower(float power) {
+    int32_t value = static_cast<int32_t>(std::lround(power));
+    if (value > 127) return 127;
+    if (value < -127) return -127;
+    return value;
+}
+
+// Top speed of a motor's gearset (rpm)
+static float gearsetRpm(const pros::AbstractMotor& motor) {
+    switch (motor.get_gearing()) {
+        case pros::MotorGears::red:   return 100.0f;
+        case pros::MotorGears::green: return 200.0f;
+        default:                      return 600.0f;
+    }
+}
+
+// Latency calibration: trials per actuator (median taken), how long to wait
+// for motion, and the test power. The drive alternates direction each trial,
+// so the robot ends up about where it started.
+constexpr int LATENCY_TRIALS = 5;
+constexpr uint32_t LATENCY_TIMEOUT_MS = 300;
+constexpr int LATENCY_DRIVE_POWER = 60;
+constexpr int LATENCY_MECHANISM_POWER = 80;
+
+// Time from a move() command to velocity onset (5% of the gearset's top
+// speed), in ms, into onsetMs. The optional second group gets the same
+// command and is timed too, into otherOnsetMs, for the drive.
+static void measureOnset(pros::AbstractMotor& motor, pros::AbstractMotor* other, int power,
+                         uint32_t& onsetMs, uint32_t& otherOnsetMs) {
+    float threshold = gearsetRpm(motor) * 0.05f;
+    float otherThreshold = other ? gearsetRpm(*other) * 0.05f : 0.0f;
+    
+    // Start from rest
+    motor.move(0);
+    if (other) other->move(0);
+    uint32_t settleStart = pros::millis();
+    while ((std::fabs(motor.get_actual_velocity()) > 1.0 ||
+            (other && std::fabs(other->get_actual_velocity()) > 1.0)) &&
+           pros::millis() - settleStart < 1000) {
+        pros::delay(5);
+    }
+    pros::delay(100);
+    
+    uint64_t start = pros::micros();
+    motor.move(power);
+    if (other) other->move(power);
+    
+    onsetMs = LATENCY_TIMEOUT_MS;
+    otherOnsetMs = other ? LATENCY_TIMEOUT_MS : 0;
+    while (pros::micros() - start < LATENCY_TIMEOUT_MS * 1000) {
+        uint32_t elapsedMs = static_cast<uint32_t>((pros::micros() - start) / 1000);
+        if (onsetMs == LATENCY_TIMEOUT_MS && std::fabs(motor.get_actual_velocity()) >= threshold) {
+            onsetMs = elapsedMs;
+        }
+        if (otherOnsetMs == LATENCY_TIMEOUT_MS && std::fabs(other->get_actual_velocity()) >= otherThreshold) {
+            otherOnsetMs = elapsedMs;
+        }
+        if (onsetMs < LATENCY_TIMEOUT_MS && otherOnsetMs < LATENCY_TIMEOUT_MS) break;
+        pros::delay(1);
+    }
+    
+    motor.move(0);
+    if (other) other->move(0);
+}
+
+// Median onset over LATENCY_TRIALS, alternating direction. With a second
+// group, the larger of the two medians, since one lead covers both. 0 if
+// either never moved.
+static uint16_t medianOnset(pros::AbstractMotor& motor, pros::AbstractMotor* other, int power) {
+    uint32_t trials[LATENCY_TRIALS];
+    uint32_t otherTrials[LATENCY_TRIALS];
+    for (int i = 0; i < LATENCY_TRIALS; i++) {
+        measureOnset(motor, other, i % 2 == 0 ? power : -power, trials[i], otherTrials[i]);
+    }
+    std::sort(trials, trials + LATENCY_TRIALS);
+    std::sort(otherTrials, otherTrials + LATENCY_TRIALS);
+    
+    uint32_t median = std::max(trials[LATENCY_TRIALS / 2], otherTrials[LATENCY_TRIALS / 2]);
+    return median >= LATENCY_TIMEOUT_MS ? 0 : static_cast<uint16_t>(median);
+}
+
+// Toggle the playback indicator every 500 ms - only redrawn when it changes, to keep passes short
+static void blinkIndicator(uint32_t elapsedMs, bool& blinkOn) {
+    bool blink = (elapsedMs / 500) % 2 == 0;
+    if (blink != blinkOn) {
+        blinkOn = blink;
+        pros::screen::set_pen(blink ? pros::c::COLOR_GREEN : pros::c::COLOR_DARK_GREEN);
+        pros::screen::fill_circle(460, 20, 15);
+    }
 }
 
 bool AutonReplay::isSDCardInserted() const {
@@ -55,13 +160,41 @@ void AutonReplay::displayCountdown(int secondsRemaining) {
     master.rumble(".");
 }
 
+void AutonReplay::init() {
+    // Carve every recording buffer from the arena now, before LVGL and friends
+    // start churning the heap. Recording and playback never allocate after this.
+    RecordingInfo info;
+    initRecordingInfo(info);
+    
+    bool ok = recording.blocks.reserve(guaranteedBlocksSize(info));
+    // Twice the frames: latency leads add a frame wherever a led channel changes between two
+    ok = compiled.prepare(2 * (REPLAY_GUARANTEED_MS / info.samplePeriodMs + 1)) && ok;
+    ok = encoder.prepare() && ok;
+    ok = streamWriter.prepare() && ok;
+    ok = prepareRecovery() && ok;
+    ok = prepareLegacyRead() && ok;
+    
+    if (!ok) {
+        master.print(0, 0, "REPLAY MEM FAILED! ");
+        master.rumble("---");
+    }
+    
+    // Actuator latencies from the last calibration, if there was one
+    loadLatencyTable(REPLAY_LATENCY_PATH, latency);
+}
+
 void AutonReplay::abortPlayback() {
     _abortRequested = true;
 }
 
 void AutonReplay::startRecording() {
+    // The commands compiled from this slot's old recording are about to go stale
+    if (!compiledEmbedded) compiledSlot = -1;
+    recordMechanisms.reset(false);
+    
     // Check SD card before starting if we plan to save
-    if (!isSDCardInserted()) {
+    bool sdCardPresent = isSDCardInserted();
+    if (!sdCardPresent) {
         master.print(0, 0, "WARNING: No SD Card!");
         master.rumble("---");
         pros::delay(1000);
@@ -77,22 +210,36 @@ void AutonReplay::startRecording() {
         }
     }
     
+    // Stream straight to the SD card when we can: fixed RAM, no length limit,
+    // and stopping only has to write the last block
+    uint8_t flags = changesOnly ? REPLAY_FLAG_CHANGES : 0;
+    changeFilter.begin(keyframeMs);
     recording.clear();
     
-    // Reserve memory to avoid reallocation during recording (5 minutes at 50Hz)
-    try {
-        recording.reserve(15000);
-    } catch (...) {
-        master.print(0, 0, "MEM RESERVE FAILED!");
-        master.rumble("---");
+    // Starting battery voltage goes in the header; the battery channel tracks it from there
+    batteryMv = static_cast<uint16_t>(pros::battery::get_voltage());
+    batteryReadMs = 0;
+    streaming = sdCardPresent && streamWriter.begin(filePath.c_str(), flags, batteryMv);
+    
+    if (!streaming) {
+        // No SD card - keep the recording in RAM instead, in the buffer init() reserved
+        if (!encoder.begin(recording, flags, batteryMv) || recording.blocks.capacity() == 0) {
+            master.print(0, 0, "MEM RESERVE FAILED!");
+            master.rumble("---");
+        }
     }
     
     // Use microseconds for precision timing
     recordStartTime = pros::micros();
     _isRecording = true;
     
-    // Reset IMU heading to 0 at start of recording for consistent reference
+    // Reset IMU heading and odometry to 0 at start of recording for consistent reference
     imu.set_heading(0);
+    chassis.setPose(0, 0, 0);
+    resetTravel();
+    checkpointPending = false;
+    movedSinceCheckpoint = false;
+    stillSinceMs = 0;
     
     // Boost task priority during recording for consistent timing
     pros::Task::current().set_priority(TASK_PRIORITY_MAX - 1);
@@ -109,7 +256,66 @@ void AutonReplay::stopRecording(bool saveToSD) {
     // Restore normal task priority
     pros::Task::current().set_priority(TASK_PRIORITY_DEFAULT);
     
-    master.print(0, 0, "STOPPED: %d frames ", recording.size());
+    // Change-only mode: store the final held state so the recording keeps its full length
+    RecordedFrame last;
+    if (changesOnly && changeFilter.tail(last)) {
+        storeFrame(last);
+    }
+    
+    if (streaming) {
+        streaming = false;
+        
+        // Not keeping it: drop the part file, so the slot's file and index stay as they were.
+        // The frames were only ever on the card, so nothing is left loaded either.
+        if (!saveToSD) {
+            streamWriter.abort();
+            recording.clear();
+            master.print(0, 0, "DISCARDED          ");
+            master.rumble(".");
+            drawStatusIndicator();
+            return;
+        }
+        
+        // Already on the card - just the tail block and the header are left to write
+        bool saved = streamWriter.finish();
+        
+        // Blocks stay on the SD card; playback() loads them when needed.
+        // If the commit failed nothing usable is loaded: the part file is left
+        // for recoverRecording() to salvage at the next init.
+        if (saved) {
+            recording.info.frameCount = streamWriter.getFrameCount();
+            recording.info.durationMs = streamWriter.getDurationMs();
+            fitModels();
+        } else {
+            recording.clear();
+        }
+        
+        master.print(0, 0, "STOPPED: %d frames ", static_cast<int>(streamWriter.getFrameCount()));
+        master.rumble(".");  // Confirm vibration
+        
+        if (saved) {
+            updateLibrary(streamWriter.getFileSize(), streamWriter.getChecksum());
+        }
+        
+        if (!saved) {
+            master.print(1, 0, "SD SAVE FAILED!    ");
+        } else if (streamWriter.getDroppedFrames() > 0) {
+            master.print(1, 0, "SAVED, %d DROPPED  ", streamWriter.getDroppedFrames());
+        } else {
+            master.print(1, 0, "SAVED TO SD!       ");
+        }
+        
+        drawStatusIndicator();
+        return;
+    }
+    
+    // Encode the partially filled last block
+    if (!encoder.finish()) {
+        master.print(0, 0, "MEMORY FULL!       ");
+    }
+    fitModels();
+    
+    master.print(0, 0, "STOPPED: %d frames ", getFrameCount());
     master.rumble(".");  // Confirm vibration
     
     if (saveToSD) {
@@ -132,23 +338,65 @@ void AutonReplay::recordFrame() {
     
     RecordedFrame frame;
     // Use microseconds for precise timing
-    frame.timestamp = pros::micros() - recordStartTime;
-    frame.leftStick = static_cast<int8_t>(master.get_analog(pros::E_CONTROLLER_ANALOG_LEFT_Y));
-    frame.rightStick = static_cast<int8_t>(master.get_analog(pros::E_CONTROLLER_ANALOG_RIGHT_Y));
+    frame.timestamp = static_cast<uint32_t>(pros::micros() - recordStartTime);
+    frame.set(CH_LEFT_STICK, master.get_analog(pros::E_CONTROLLER_ANALOG_LEFT_Y));
+    frame.set(CH_RIGHT_STICK, master.get_analog(pros::E_CONTROLLER_ANALOG_RIGHT_Y));
     
     // Record actual motor voltage (get_voltage returns millivolts: -12000 to 12000)
     // Scale to -127 to 127 range to match what move() expects
-    frame.intakePower = static_cast<int8_t>(Intake.get_voltage() * 127 / 12000);
-    frame.outtakePower = static_cast<int8_t>(Outtake.get_voltage() * 127 / 12000);
+    frame.set(CH_INTAKE, Intake.get_voltage() * 127 / 12000);
+    frame.set(CH_OUTTAKE, Outtake.get_voltage() * 127 / 12000);
+    
+    frame.set(CH_HEADING, replayChannels.toRaw(CH_HEADING, imu.get_heading()));  // For drift correction
+    frame.set(CH_BUTTONS, packButtons());
+    
+    // Mechanism state machines, so playback can run the same transitions.
+    // Without attached ones, rebuild their state from the button toggles.
+    MechanismEvent changes[MECH_COUNT];
+    recordMechanisms.step(frame, frame.timestamp, changes);
+    uint8_t mechanisms = recordMechanisms.getStateBits();
+    if (outtakeSource && pneumaticSource) {
+        mechanisms = 0;
+        if (outtakeSource->isMidScoring()) mechanisms |= MECH_STATE_MID_SCORING;
+        if (outtakeSource->isUnjamActive()) mechanisms |= MECH_STATE_UNJAM;
+        if (pneumaticSource->getDescoreState()) mechanisms |= MECH_STATE_DESCORE;
+        if (pneumaticSource->getUnloaderState()) mechanisms |= MECH_STATE_UNLOADER;
+    }
+    frame.set(CH_MECHANISMS, mechanisms);
+    
+    // Odometry position, for pose-tracked playback
+    lemlib::Pose pose = chassis.getPose();
+    frame.set(CH_POSE_X, replayChannels.toRaw(CH_POSE_X, pose.x));
+    frame.set(CH_POSE_Y, replayChannels.toRaw(CH_POSE_Y, pose.y));
     
-    frame.heading = imu.get_heading();  // Record heading for drift correction
-    frame.buttons = packButtons();
+    // Measured speeds, for velocity playback
+    float leftVel = averageVelocity(left_motors);
+    float rightVel = averageVelocity(right_motors);
+    frame.set(CH_LEFT_VEL, replayChannels.toRaw(CH_LEFT_VEL, leftVel));
+    frame.set(CH_RIGHT_VEL, replayChannels.toRaw(CH_RIGHT_VEL, rightVel));
+    frame.set(CH_INTAKE_VEL, replayChannels.toRaw(CH_INTAKE_VEL, Intake.get_actual_velocity()));
+    frame.set(CH_OUTTAKE_VEL, replayChannels.toRaw(CH_OUTTAKE_VEL, Outtake.get_actual_velocity()));
     
-    // Safe push_back with error handling
-    try {
-        recording.push_back(frame);
-    } catch (...) {
-        // Memory allocation failed - stop recording
+    // Battery voltage only moves slowly - re-read it now and then and hold it
+    // in between, so the channel costs nothing in the columnar encoding
+    if (frame.timestamp / 1000 - batteryReadMs >= REPLAY_BATTERY_PERIOD_MS) {
+        batteryMv = static_cast<uint16_t>(pros::battery::get_voltage());
+        batteryReadMs = frame.timestamp / 1000;
+    }
+    frame.set(CH_BATTERY, batteryMv);
+    
+    // Distance rolled along the path, for distance-indexed playback
+    frame.set(CH_TRAVEL, replayChannels.toRaw(CH_TRAVEL, updateTravel()));
+    
+    // Checkpoints playback can re-sync odometry at
+    frame.set(CH_CHECKPOINT, nextCheckpoint(leftVel, rightVel, frame.timestamp / 1000));
+    
+    // Any mechanisms registered in the channel registry
+    replayChannels.sample(frame);
+    
+    // Change-only mode skips frames where nothing moved past its threshold
+    if ((!changesOnly || changeFilter.accept(frame)) && !storeFrame(frame)) {
+        // RAM buffer is full - stop recording and keep what we have
         master.print(0, 0, "MEMORY FULL!       ");
         stopRecording(true);
         return;
@@ -166,24 +414,139 @@ void AutonReplay::recordFrame() {
     pros::screen::fill_circle(460, 20, 15);
 }
 
-void AutonReplay::applyHeadingCorrection(int& left, int& right, float targetHeading, float currentHeading) {
-    // Calculate heading error (account for wrap-around at 360)
-    float error = targetHeading - currentHeading;
+void AutonReplay::fitModels() {
+    if (!recording.blocks.empty()) {
+        // In RAM - the models go out with the header when it is saved
+        RecordingReader reader(recording);
+        fitFeedforward(reader, recording.info);
+        return;
+    }
     
-    // Normalize error to -180 to 180 range
-    while (error > 180) error -= 360;
-    while (error < -180) error += 360;
+    // Streamed - read it back off the card and patch the header in place
+    if (!streamReader.open(filePath.c_str())) return;
+    RecordingInfo info = streamReader.getInfo();
+    fitFeedforward(streamReader, info);
+    bool failed = streamReader.hasFailed();
+    streamReader.close();
     
-    // Apply proportional correction
-    float correction = error * imuCorrectionGain;
+    if (!failed && info.modelCount > 0 && updateRecordingHeader(filePath.c_str(), info)) {
+        recording.info = info;
+    }
+}
+
+bool AutonReplay::storeFrame(const RecordedFrame& frame) {
+    if (streaming) {
+        // Never blocks - the flush task writes full blocks in the background.
+        // A dropped frame is counted by the writer, not treated as full.
+        streamWriter.addFrame(frame);
+        return true;
+    }
+    return encoder.addFrame(frame);
+}
+
+float AutonReplay::driveCommand(const RecordedFrame& frame, bool rightSide) const {
+    if (!velocityActive) {
+        // What the drive got when this was recorded, deadband included
+        uint8_t stick = rightSide ? CH_RIGHT_STICK : CH_LEFT_STICK;
+        return appliedCommand(stick, frame.get(stick));
+    }
     
-    // Clamp correction to prevent overcorrection
-    if (correction > 30) correction = 30;
-    if (correction < -30) correction = -30;
+    uint8_t id = rightSide ? CH_RIGHT_VEL : CH_LEFT_VEL;
+    return replayChannels.toUnits(id, frame.get(id)) * 127.0f / driveMaxRpm;
+}
+
+float AutonReplay::modelCommand(const ActuatorModel& model, const RecordedFrame& frame, const RecordedFrame* next,
+                               float speed) const {
+    // Time scaling multiplies velocities by speed and accelerations by speed squared
+    uint8_t id = model.channel;
+    float velocity = replayChannels.toUnits(id, frame.get(id));
+    float acceleration = 0.0f;
+    if (next && next->timestamp > frame.timestamp) {
+        float dt = (next->timestamp - frame.timestamp) / 1e6f;
+        acceleration = (replayChannels.toUnits(id, next->get(id)) - velocity) / dt;
+    }
     
-    // Apply correction (positive error = robot is too far right, need to turn left)
-    left = static_cast<int>(left - correction);
-    right = static_cast<int>(right + correction);
+    float volts = feedforwardVolts(model, velocity * speed, acceleration * speed * speed);
+    return volts * 127.0f / REPLAY_NOMINAL_VOLTS;
+}
+
+void AutonReplay::driveMechanisms(const RecordedFrame& frame) {
+    // Unjam and mid-scoring drive the intake/outtake themselves (see play())
+    if (playbackOuttake.isMidScoring()) {
+        replayChannels.apply(frame);
+        return;
+    }
+    
+    // Mechanisms hold steady speeds, so their models run without the acceleration term
+    const ActuatorModel* intakeModel = modelActive ? findModel(playInfo, CH_INTAKE_VEL) : nullptr;
+    const ActuatorModel* outtakeModel = modelActive ? findModel(playInfo, CH_OUTTAKE_VEL) : nullptr;
+    if (intakeModel && outtakeModel) {
+        float intakeVolts = feedforwardVolts(*intakeModel, replayChannels.toUnits(CH_INTAKE_VEL, frame.get(CH_INTAKE_VEL)), 0);
+        float outtakeVolts = feedforwardVolts(*outtakeModel, replayChannels.toUnits(CH_OUTTAKE_VEL, frame.get(CH_OUTTAKE_VEL)), 0);
+        Intake.move_voltage(static_cast<int32_t>(std::lround(intakeVolts * 1000)));
+        Outtake.move_voltage(static_cast<int32_t>(std::lround(outtakeVolts * 1000)));
+    } else if (velocityActive) {
+        Intake.move_velocity(static_cast<int32_t>(std::lround(replayChannels.toUnits(CH_INTAKE_VEL, frame.get(CH_INTAKE_VEL)))));
+        Outtake.move_velocity(static_cast<int32_t>(std::lround(replayChannels.toUnits(CH_OUTTAKE_VEL, frame.get(CH_OUTTAKE_VEL)))));
+    } else {
+        // voltageRatio stays 1 unless voltage compensation is running
+        Intake.move(clampPower(frame.get(CH_INTAKE) * voltageRatio));
+        Outtake.move(clampPower(frame.get(CH_OUTTAKE) * voltageRatio));
+    }
+    
+    // Registered mechanisms drive themselves
+    replayChannels.apply(frame);
+}
+
+float AutonReplay::segmentSpeed(const RecordedFrame& from, const RecordedFrame& to) const {
+    float fromCommand[2] = {driveCommand(from, false), driveCommand(from, true)};
+    float toCommand[2] = {driveCommand(to, false), driveCommand(to, true)};
+    return scaledSegmentSpeed(fromCommand, toCommand, (to.timestamp - from.timestamp) / 1e6f, timeScale, maxDriveAccel);
+}
+
+// Recorded frame as a pose in standard position (heading is a compass angle)
+static TrackPose framePose(const RecordedFrame& frame) {
+    TrackPose pose;
+    pose.x = replayChannels.toUnits(CH_POSE_X, frame.get(CH_POSE_X));
+    pose.y = replayChannels.toUnits(CH_POSE_Y, frame.get(CH_POSE_Y));
+    pose.theta = wrapRadians(static_cast<float>(M_PI / 2) -
+                             replayChannels.toUnits(CH_HEADING, frame.get(CH_HEADING)) * static_cast<float>(M_PI / 180));
+    return pose;
+}
+
+void AutonReplay::applyPoseCorrection(int& left, int& right, const RecordedFrame& target, const RecordedFrame* next,
+                                      float speed) {
+    TrackPose reference = framePose(target);
+    lemlib::Pose odom = chassis.getPose(true, true);
+    TrackPose actual;
+    actual.x = odom.x;
+    actual.y = odom.y;
+    actual.theta = odom.theta;
+    
+    float error = std::hypot(reference.x - actual.x, reference.y - actual.y);
+    if (error > maxPoseError) maxPoseError = error;
+    
+    // Reference velocity from the recorded motion towards the next frame, at playback speed
+    float refV = 0.0f;
+    float refOmega = 0.0f;
+    if (next && next->timestamp > target.timestamp) {
+        TrackPose ahead = framePose(*next);
+        float dt = (next->timestamp - target.timestamp) / 1e6f / speed;
+        refV = (std::cos(reference.theta) * (ahead.x - reference.x) +
+                std::sin(reference.theta) * (ahead.y - reference.y)) / dt;
+        refOmega = wrapRadians(ahead.theta - reference.theta) / dt;
+    }
+    
+    float v, omega;
+    tracker.compute(reference, refV, refOmega, actual, v, omega);
+    
+    // The sticks already produce the reference motion - only add the correction
+    float dv = v - refV;
+    float dOmega = omega - refOmega;
+    float maxWheelSpeed = drivetrain.rpm * static_cast<float>(M_PI) * drivetrain.wheelDiameter / 60.0f;  // inches/s
+    float countsPerIps = 127.0f / maxWheelSpeed;
+    left = static_cast<int>(std::lround(left + (dv - dOmega * drivetrain.trackWidth / 2) * countsPerIps));
+    right = static_cast<int>(std::lround(right + (dv + dOmega * drivetrain.trackWidth / 2) * countsPerIps));
     
     // Clamp final values to valid motor range
     if (left > 127) left = 127;
@@ -193,137 +556,760 @@ void AutonReplay::applyHeadingCorrection(int& left, int& right, float targetHead
 }
 
 void AutonReplay::playback() {
-    if (recording.empty()) {
-        // Try loading from SD card
-        if (!loadFromSD()) {
+    // Preloaded and compiled for the current settings: just walk the commands
+    if (compiledSlot == currentSlot && !compiledEmbedded && canPlayCompiled(recording.info)) {
+        playCompiled();
+        return;
+    }
+    
+    // Frames are decoded one at a time, either from the encoded blocks in RAM
+    // or straight off the SD card through the prefetch ring
+    RecordingReader memoryReader(recording);
+    FrameSource* source = &memoryReader;
+    
+    // Blocks may still be on the SD card only (e.g. right after a streamed recording).
+    // Recordings too long for the RAM buffer are streamed as well.
+    if (recording.blocks.empty()) {
+        bool stream = streamingPlayback || !loadFromSD();
+        if (stream && isSDCardInserted() && streamReader.open(filePath.c_str())) {
+            source = &streamReader;
+        } else if (stream) {
             master.print(0, 0, "NO RECORDING!      ");
             return;
+        } else {
+            memoryReader = RecordingReader(recording);
+        }
+    }
+    
+    play(*source);
+    
+    if (source == &streamReader) {
+        if (streamReader.hasFailed()) {
+            master.print(0, 0, "SD READ ERROR!     ");
+        }
+        streamReader.close();
+    }
+}
+
+bool AutonReplay::playEmbedded(int slot) {
+    if (!replayLibrary.hasEmbedded(slot)) return false;
+    
+    const EmbeddedRecording& embedded = replayLibrary.getEmbedded(slot);
+    if (compiledSlot == slot && compiledEmbedded && canPlayCompiled(embedded.info)) {
+        playCompiled();
+        return true;
+    }
+    
+    // Decodes straight out of the linked-in blob - no SD card, no allocation, no load
+    RecordingReader reader(embedded.info, embedded.blocks, embedded.size);
+    play(reader);
+    return true;
+}
+
+void AutonReplay::selectModes(const RecordingInfo& info) {
+    playInfo = info;
+    
+    // Older recordings have no pose to track
+    trackingActive = poseTracking && hasChannel(info, CH_POSE_X) && hasChannel(info, CH_POSE_Y);
+    
+    // Velocity mode needs a recording that has the measured speeds
+    velocityActive = velocityPlayback && hasChannel(info, CH_LEFT_VEL) && hasChannel(info, CH_RIGHT_VEL) &&
+                     hasChannel(info, CH_INTAKE_VEL) && hasChannel(info, CH_OUTTAKE_VEL);
+    driveMaxRpm = gearsetRpm(left_motors);
+    
+    // Model-based playback replaces velocity mode when the recording has drive models
+    modelActive = modelPlayback && findModel(playInfo, CH_LEFT_VEL) && findModel(playInfo, CH_RIGHT_VEL);
+    if (modelActive) velocityActive = false;
+    
+    // Voltage compensation: open loop only (the velocity loops already
+    // compensate), and only with a recorded voltage to compare against
+    compensatingActive = voltageCompensation && !velocityActive && !modelActive &&
+                         (hasChannel(info, CH_BATTERY) || info.batteryMv > 0);
+    
+    // Distance indexing needs the recorded travel to line the wheel up against
+    distanceActive = distanceIndexed && hasChannel(info, CH_TRAVEL);
+    
+    // Re-syncing needs checkpoints, and the pose recorded at them
+    resyncActive = checkpointResync && hasChannel(info, CH_CHECKPOINT) && hasChannel(info, CH_POSE_X) &&
+                   hasChannel(info, CH_POSE_Y);
+}
+
+bool AutonReplay::canPlayCompiled(const RecordingInfo& info) {
+    // Compiled commands are the plain open-loop playback only: anything that
+    // needs the frames at run time (blending, odometry, measured speeds,
+    // models, battery, the tracking wheel, checkpoints, registered mechanisms) goes through play()
+    selectModes(info);
+    return compiled.matches(timeScale, maxDriveAccel) && !interpolatedPlayback && !trackingActive &&
+           !velocityActive && !modelActive && !compensatingActive && !distanceActive && !resyncActive &&
+           !replayChannels.hasApply();
+}
+
+bool AutonReplay::calibrateLatency() {
+    if (_isRecording || _isPlaying) return false;
+    
+    master.print(0, 0, "CALIBRATING...     ");
+    master.rumble(".");
+    pros::delay(1000);  // A moment to stand clear - the drive twitches back and forth
+    
+    LatencyTable table = latency;
+    table.ms[LAT_DRIVE] = medianOnset(left_motors, &right_motors, LATENCY_DRIVE_POWER);
+    table.ms[LAT_INTAKE] = medianOnset(Intake, nullptr, LATENCY_MECHANISM_POWER);
+    table.ms[LAT_OUTTAKE] = medianOnset(Outtake, nullptr, LATENCY_MECHANISM_POWER);
+    
+    // Pistons have nothing to time them against - use the configured actuation time
+    table.ms[LAT_MID_SCORING] = pistonLatencyMs;
+    table.ms[LAT_DESCORE] = pistonLatencyMs;
+    table.ms[LAT_UNLOADER] = pistonLatencyMs;
+    
+    latency = table;
+    compiledSlot = -1;  // Compiled with the old leads
+    
+    master.print(0, 0, "D%d I%d O%d ms      ", table.ms[LAT_DRIVE], table.ms[LAT_INTAKE], table.ms[LAT_OUTTAKE]);
+    bool saved = isSDCardInserted() && saveLatencyTable(REPLAY_LATENCY_PATH, table);
+    master.print(1, 0, saved ? "SAVED TO SD!       " : "NOT SAVED!         ");
+    
+    // An actuator that never moved is left without a lead
+    return table.ms[LAT_DRIVE] > 0 && table.ms[LAT_INTAKE] > 0 && table.ms[LAT_OUTTAKE] > 0;
+}
+
+void AutonReplay::setPistonLatency(uint16_t ms) {
+    pistonLatencyMs = ms;
+    latency.ms[LAT_MID_SCORING] = ms;
+    latency.ms[LAT_DESCORE] = ms;
+    latency.ms[LAT_UNLOADER] = ms;
+    compiledSlot = -1;
+}
+
+FrameSource& AutonReplay::withLeads(FrameSource& source) {
+    if (!latencyCompensation) return source;
+    
+    // Leads are real time - on a faster timeline they cover more of the recording
+    auto lead = [this](LatencyActuator actuator) {
+        return static_cast<uint32_t>(latency.ms[actuator] * 1000.0f * timeScale);
+    };
+    
+    leadSource.attach(source);
+    leadSource.addLane(CH_LEFT_STICK, -1, lead(LAT_DRIVE));
+    leadSource.addLane(CH_RIGHT_STICK, -1, lead(LAT_DRIVE));
+    leadSource.addLane(CH_LEFT_VEL, -1, lead(LAT_DRIVE));
+    leadSource.addLane(CH_RIGHT_VEL, -1, lead(LAT_DRIVE));
+    leadSource.addLane(CH_INTAKE, -1, lead(LAT_INTAKE));
+    leadSource.addLane(CH_INTAKE_VEL, -1, lead(LAT_INTAKE));
+    leadSource.addLane(CH_OUTTAKE, -1, lead(LAT_OUTTAKE));
+    leadSource.addLane(CH_OUTTAKE_VEL, -1, lead(LAT_OUTTAKE));
+    
+    // Each piston's bits, in both the mechanism states and the buttons older recordings replay from
+    leadSource.addLane(CH_MECHANISMS, MECH_STATE_MID_SCORING | MECH_STATE_UNJAM, lead(LAT_MID_SCORING));
+    leadSource.addLane(CH_MECHANISMS, MECH_STATE_DESCORE, lead(LAT_DESCORE));
+    leadSource.addLane(CH_MECHANISMS, MECH_STATE_UNLOADER, lead(LAT_UNLOADER));
+    leadSource.addLane(CH_BUTTONS, 1 << BTN_X, lead(LAT_MID_SCORING));
+    leadSource.addLane(CH_BUTTONS, 1 << BTN_A, lead(LAT_DESCORE));
+    leadSource.addLane(CH_BUTTONS, 1 << BTN_B, lead(LAT_UNLOADER));
+    
+    return leadSource.getLaneCount() > 0 ? leadSource : source;
+}
+
+bool AutonReplay::compileRecording(bool embedded) {
+    compiledSlot = -1;
+    bool ok;
+    if (embedded) {
+        const EmbeddedRecording& recordingBlob = replayLibrary.getEmbedded(currentSlot);
+        RecordingReader reader(recordingBlob.info, recordingBlob.blocks, recordingBlob.size);
+        ok = compiled.compile(withLeads(reader), timeScale, maxDriveAccel);
+    } else {
+        if (recording.blocks.empty()) return false;
+        RecordingReader reader(recording);
+        ok = compiled.compile(withLeads(reader), timeScale, maxDriveAccel);
+    }
+    
+    if (ok) {
+        compiledSlot = currentSlot;
+        compiledEmbedded = embedded;
+    }
+    return ok;
+}
+
+void AutonReplay::resetTravel() {
+    travel = 0.0f;
+    lastWheel = vertical_tracking_wheel.getDistanceTraveled();
+}
+
+float AutonReplay::updateTravel() {
+    // Backing up counts too - travel is path length, so it only ever grows
+    float wheel = vertical_tracking_wheel.getDistanceTraveled();
+    if (std::isfinite(wheel)) {
+        travel += std::fabs(wheel - lastWheel);
+        lastWheel = wheel;
+    }
+    return travel;
+}
+
+uint8_t AutonReplay::nextCheckpoint(float leftVel, float rightVel, uint32_t timeMs) {
+    if (checkpointPending) {
+        checkpointPending = false;
+        movedSinceCheckpoint = false;
+        return CHECKPOINT_MARKED;
+    }
+    if (!autoCheckpoints) return 0;
+    
+    // One checkpoint per stop, once the drive has stood still long enough to be sure
+    bool still = std::fabs(leftVel) < REPLAY_CHECKPOINT_STILL_RPM && std::fabs(rightVel) < REPLAY_CHECKPOINT_STILL_RPM;
+    if (!still) {
+        movedSinceCheckpoint = true;
+        stillSinceMs = timeMs;
+        return 0;
+    }
+    if (movedSinceCheckpoint && timeMs - stillSinceMs >= REPLAY_CHECKPOINT_STOP_MS) {
+        movedSinceCheckpoint = false;
+        return CHECKPOINT_STOP;
+    }
+    return 0;
+}
+
+bool AutonReplay::resyncTo(const RecordedFrame& checkpoint) {
+    // LemLib's convention, which is the recording's: heading in degrees, clockwise from +y
+    float x = replayChannels.toUnits(CH_POSE_X, checkpoint.get(CH_POSE_X));
+    float y = replayChannels.toUnits(CH_POSE_Y, checkpoint.get(CH_POSE_Y));
+    float heading = replayChannels.toUnits(CH_HEADING, checkpoint.get(CH_HEADING));
+    
+    lemlib::Pose pose = chassis.getPose();
+    float distance = std::hypot(x - pose.x, y - pose.y);
+    float headingError = std::fabs(std::remainder(heading - pose.theta, 360.0f));
+    if (distance <= resyncDistance && headingError <= resyncHeading) return false;
+    
+    uint32_t startMs = pros::millis();
+    master.print(0, 0, "RE-SYNC %.1fin %.0fdeg ", distance, headingError);
+    
+    // LemLib drives until it's done - take the drive off the heading controller
+    bool holding = headingController.isRunning();
+    headingController.stop();
+    
+    if (distance > resyncDistance) {
+        // Back up to a checkpoint behind the robot rather than turning round for it
+        float rad = pose.theta * static_cast<float>(M_PI / 180);
+        lemlib::MoveToPoseParams params;
+        params.forwards = (x - pose.x) * std::sin(rad) + (y - pose.y) * std::cos(rad) >= 0;
+        chassis.moveToPose(x, y, heading, REPLAY_RESYNC_TIMEOUT_MS, params);
+    } else {
+        chassis.turnToHeading(heading, REPLAY_RESYNC_TIMEOUT_MS);
+    }
+    
+    if (!waitForMotion()) _abortRequested = true;  // Hand the stop on to playback
+    left_motors.move(0);
+    right_motors.move(0);
+    if (holding) headingController.resume();
+    
+    resyncCount++;
+    resyncMs += pros::millis() - startMs;
+    master.print(0, 0, "REPLAYING (<>=STOP)");
+    return true;
+}
+
+bool AutonReplay::waitForMotion(uint32_t atLeastMs) {
+    uint32_t startMs = pros::millis();
+    while (chassis.isInMotion() || pros::millis() - startMs < atLeastMs) {
+        if (checkEmergencyStop() || _abortRequested) {
+            chassis.cancelMotion();
+            _abortRequested = false;
+            master.print(0, 0, "MOTION ABORTED!    ");
+            master.rumble("--");
+            return false;
         }
+        
+        // Mid-scoring and the unjam pulse keep running, as they do in playback
+        playbackOuttake.runMidScoring();
+        pros::delay(10);
     }
+    return true;
+}
+
+// Recording poses are relative to where the recording started, which is at
+// origin on the field (LemLib convention: heading clockwise from +y, degrees)
+static lemlib::Pose toRecordingFrame(const lemlib::Pose& field, const lemlib::Pose& origin) {
+    float rad = origin.theta * static_cast<float>(M_PI / 180);
+    float dx = field.x - origin.x;
+    float dy = field.y - origin.y;
+    return lemlib::Pose(dx * std::cos(rad) - dy * std::sin(rad), dx * std::sin(rad) + dy * std::cos(rad),
+                        field.theta - origin.theta);
+}
+
+static lemlib::Pose toFieldFrame(const lemlib::Pose& recorded, const lemlib::Pose& origin) {
+    float rad = origin.theta * static_cast<float>(M_PI / 180);
+    return lemlib::Pose(origin.x + recorded.x * std::cos(rad) + recorded.y * std::sin(rad),
+                        origin.y - recorded.x * std::sin(rad) + recorded.y * std::cos(rad),
+                        recorded.theta + origin.theta);
+}
+
+bool AutonReplay::playSegment(int slot, uint32_t fromMs, uint32_t toMs, const lemlib::Pose& origin) {
+    // The slot's embedded recording if it has one, otherwise its own (RAM, or loaded from the SD card)
+    RecordingReader reader(recording);
+    if (replayLibrary.hasEmbedded(slot)) {
+        const EmbeddedRecording& embedded = replayLibrary.getEmbedded(slot);
+        reader = RecordingReader(embedded.info, embedded.blocks, embedded.size);
+    } else {
+        selectSlot(slot);
+        if (recording.blocks.empty() && !loadFromSD()) {
+            master.print(0, 0, "NO RECORDING!      ");
+            return false;
+        }
+        reader = RecordingReader(recording);
+    }
+    
+    SegmentSource part;
+    if (!part.begin(reader, fromMs, toMs)) {
+        master.print(0, 0, "EMPTY SEGMENT!     ");
+        return false;
+    }
+    
+    // Odometry works in the recording's frame for the segment, so pose
+    // tracking, checkpoints and the heading targets compare like for like
+    chassis.setPose(toRecordingFrame(chassis.getPose(), origin));
     
+    segment = &part;
+    play(part);
+    segment = nullptr;
+    bool ok = !lastAborted;
+    
+    chassis.setPose(toFieldFrame(chassis.getPose(), origin));
+    return ok;
+}
+
+void AutonReplay::resetMechanisms() {
+    playbackOuttake = OuttakeControl();
+    playbackPneumatics = PneumaticControl();
+}
+
+void AutonReplay::setMechanism(uint8_t output, bool value) {
+    // The same state machines opcontrol runs - entering mid-scoring starts the unjam pulse
+    switch (output) {
+        case MECH_MID_SCORING: playbackOuttake.setMidScoring(value); break;
+        case MECH_DESCORE:     playbackPneumatics.setDescore(value); break;
+        case MECH_UNLOADER:    playbackPneumatics.setUnloader(value); break;
+    }
+}
+
+void AutonReplay::beginPlayback() {
     _isPlaying = true;
     _abortRequested = false;  // Reset abort flag
-    prevButtons = 0;
-    
-    // Reset toggle states for pneumatics (motor velocities are recorded directly now)
-    bool midScoring = false;
-    bool descore = false;
-    bool unloader = false;
     
-    // Reset IMU heading to match the recording start
-    imu.set_heading(0);
-    pros::delay(50);  // Brief delay to let IMU settle
+    // Reset IMU heading and odometry to match the recording start. A segment
+    // carries on from wherever the robot is (playSegment() sets up the pose).
+    if (!segment) {
+        imu.set_heading(0);
+        chassis.setPose(0, 0, 0);
+        pros::delay(50);  // Brief delay to let IMU settle
+    }
+    resetTravel();
     
     // Boost task priority during playback for consistent timing
     pros::Task::current().set_priority(TASK_PRIORITY_MAX - 1);
     
-    // Use microseconds for precision timing
-    uint64_t playStartTime = pros::micros();
-    size_t frameIndex = 0;
+    // Mechanisms start as a recording does, everything off - except in a
+    // segment, where they carry over from the steps before
+    if (!segment) resetMechanisms();
+    
+    playbackTiming.reset();
+    coalescedFrames = 0;
+    timeShiftUs = 0;
+    distanceLagUs = 0;
+    resyncCount = 0;
+    resyncMs = 0;
+    maxPoseError = 0.0f;
+    voltageRatio = 1.0f;
+    compensatedPasses = 0;
+    saturatedPasses = 0;
     
     master.print(0, 0, "REPLAYING (<>=STOP)");
     
     // Draw green indicator
     pros::screen::set_pen(pros::c::COLOR_GREEN);
     pros::screen::fill_circle(460, 20, 15);
+}
+
+void AutonReplay::endPlayback() {
+    // Take the drive back before stopping it
+    headingController.stop();
+    
+    // Stop all motors at end. A segment leaves the intake/outtake running
+    // into whatever comes next.
+    left_motors.move(0);
+    right_motors.move(0);
+    if (!segment) {
+        Intake.move(0);
+        Outtake.move(0);
+    }
+    
+    // Restore normal task priority
+    pros::Task::current().set_priority(TASK_PRIORITY_DEFAULT);
     
-    while (frameIndex < recording.size()) {
+    _isPlaying = false;
+    lastAborted = _abortRequested;
+    _abortRequested = false;
+    
+    if (!lastAborted) {
+        master.print(0, 0, "REPLAY COMPLETE!   ");
+    }
+    
+    // Timing summary - shows at a glance whether late commands could explain a bad run
+    master.print(1, 0, "p99 %.1f max %.1fms ",
+                 playbackTiming.getP99Us() / 1000.0f, playbackTiming.getMaxUs() / 1000.0f);
+    
+    // Achieved length against the recording's, to see what time scaling bought
+    master.print(2, 0, "%.1fs of %.1fs     ", lastPlaybackMs / 1000.0f, playInfo.durationMs / 1000.0f);
+    
+    // Clear indicator
+    pros::screen::set_pen(pros::c::COLOR_BLACK);
+    pros::screen::fill_circle(460, 20, 15);
+}
+
+void AutonReplay::playCompiled() {
+    beginPlayback();
+    headingController.start(DriveOutput::MOVE, driveMaxRpm);
+    
+    // Same clocks as play(), but every decision was made when compiling -
+    // each pass only moves two cursors over plain data
+    uint64_t playStartTime = pros::micros();
+    uint32_t wakeTime = pros::millis();
+    size_t commandCount = compiled.getCommandCount();
+    size_t eventCount = compiled.getEventCount();
+    size_t cursor = 0;          // Next command to send
+    size_t eventCursor = 0;     // Next mechanism event
+    uint64_t shifted = 0;       // Time-shift policy: how far the timeline has been pushed back
+    bool blinkOn = false;
+    
+    while (cursor < commandCount) {
         // Check for emergency stop (Y + A buttons)
         if (checkEmergencyStop() || _abortRequested) {
+            _abortRequested = true;
             master.print(0, 0, "PLAYBACK ABORTED!  ");
             master.rumble("--");
             break;
         }
         
-        uint64_t elapsed = pros::micros() - playStartTime;
+        uint64_t now = pros::micros();
+        uint64_t elapsed = now - playStartTime - shifted;
+        
+        // Woke up more than a period late: carry on from the overdue command
+        uint32_t dueTime = compiled.getCommand(cursor).time;
+        if (catchUpPolicy == CatchUpPolicy::TIME_SHIFT && elapsed > dueTime + playbackPeriodMs * 1000) {
+            shifted += elapsed - dueTime;
+            timeShiftUs += static_cast<uint32_t>(elapsed - dueTime);
+            elapsed = dueTime;
+        }
+        
+        // Mechanism events always fire, in order
+        while (eventCursor < eventCount && compiled.getEvent(eventCursor).time <= elapsed) {
+            const MechanismEvent& event = compiled.getEvent(eventCursor++);
+            setMechanism(event.output, event.value);
+        }
+        
+        // Unjam and mid-scoring drive the intake/outtake themselves while they run
+        bool mechanismsOwnMotors = playbackOuttake.runMidScoring();
+        
+        while (cursor < commandCount && compiled.getCommand(cursor).time <= elapsed) {
+            const PlaybackCommand& command = compiled.getCommand(cursor++);
+            playbackTiming.add(static_cast<uint32_t>(elapsed - command.time) + static_cast<uint32_t>(pros::micros() - now));
+            
+            // Coalescing only sends the newest overdue command
+            bool newest = cursor == commandCount || compiled.getCommand(cursor).time > elapsed;
+            if (catchUpPolicy == CatchUpPolicy::COALESCE && !newest) {
+                coalescedFrames++;
+                continue;
+            }
+            
+            if (!mechanismsOwnMotors) {
+                Intake.move(command.intake);
+                Outtake.move(command.outtake);
+            }
+            headingController.post(replayChannels.toUnits(CH_HEADING, command.heading), command.left, command.right);
+        }
+        
+        blinkIndicator(static_cast<uint32_t>(elapsed / 1000), blinkOn);
+        
+        if (cursor == commandCount) break;
+        
+        // Sleep until the next command is due, or one period at most
+        uint32_t untilDueUs = static_cast<uint32_t>(compiled.getCommand(cursor).time - elapsed);
+        uint32_t dueMs = pros::millis() + (untilDueUs + 999) / 1000;
+        uint32_t step = dueMs > wakeTime ? dueMs - wakeTime : 1;
+        if (step > playbackPeriodMs) step = playbackPeriodMs;
+        pros::Task::delay_until(&wakeTime, step);
+    }
+    
+    lastPlaybackMs = static_cast<uint32_t>((pros::micros() - playStartTime) / 1000);
+    endPlayback();
+}
+
+void AutonReplay::play(FrameSource& recorded) {
+    // Actuators with a measured lag get their commands early
+    FrameSource& source = withLeads(recorded);
+    
+    beginPlayback();
+    MechanismTracker mechanisms;
+    mechanisms.reset(hasChannel(source.getInfo(), CH_MECHANISMS));
+    
+    // A segment starts in the state the recording had reached by then
+    if (segment) {
+        mechanisms = segment->getMechanisms();
+        for (uint8_t i = 0; i < MECH_COUNT; i++) {
+            setMechanism(i, mechanisms.getState(i));
+        }
+        
+        // Start where the segment was recorded from, if the robot isn't there
+        // already. It counts as a re-sync, and the drive there isn't travel.
+        const RecordingInfo& info = source.getInfo();
+        if (hasChannel(info, CH_POSE_X) && hasChannel(info, CH_POSE_Y) && resyncTo(segment->getStart())) {
+            resetTravel();
+        }
+    }
+    
+    // Use microseconds for precision timing. wakeTime is the scheduler's
+    // millisecond clock - delay_until() advances it by exactly each step, so
+    // wake-ups don't drift however long a pass takes.
+    uint64_t playStartTime = pros::micros();
+    uint32_t wakeTime = pros::millis();
+    
+    // Position in the recording (microseconds). Advances at speed times real
+    // time, where speed is the time scale, cut back on segments the motors
+    // can't keep up with. Distance-indexed playback moves it by the tracking
+    // wheel instead, and clock keeps the time-based position to fall back on.
+    uint64_t elapsed = 0;
+    uint64_t clock = 0;
+    uint64_t lastMicros = playStartTime;
+    float speed = timeScale;
+    bool blinkOn = false;
+    
+    RecordedFrame frame;
+    bool haveFrame = source.next(frame);
+    uint8_t lastCheckpoint = 0;     // Lead frames repeat a checkpoint - only its first frame counts
+    
+    // Latest frame played - the drive keeps following it until the next one is due,
+    // which is what rebuilds the held values of a change-only recording
+    RecordedFrame current;
+    bool haveCurrent = false;
+    
+    // Only blend across consecutive samples - longer gaps (change-only
+    // recordings, dropped frames) are held, as recorded
+    uint32_t maxBlendGapUs = source.getInfo().samplePeriodMs * 2000;
+    
+    // Pick playback modes from what the recording has
+    const RecordingInfo& info = source.getInfo();
+    selectModes(info);
+    bool tracking = trackingActive;
+    bool compensating = compensatingActive;
+    bool batteryChannel = hasChannel(info, CH_BATTERY);
+    float currentMv = static_cast<float>(pros::battery::get_voltage());
+    
+    // Without pose tracking, the heading controller owns the drive and
+    // playback only posts it the target heading and base commands
+    if (!tracking) {
+        DriveOutput mode = modelActive ? DriveOutput::VOLTAGE : velocityActive ? DriveOutput::VELOCITY : DriveOutput::MOVE;
+        headingController.start(mode, driveMaxRpm, segment ? chassis.getPose().theta : 0.0f);
+    }
+    
+    while (haveFrame) {
+        // Check for emergency stop (Y + A buttons)
+        if (checkEmergencyStop() || _abortRequested) {
+            _abortRequested = true;
+            master.print(0, 0, "PLAYBACK ABORTED!  ");
+            master.rumble("--");
+            break;
+        }
+        
+        uint64_t now = pros::micros();
+        uint64_t advance = static_cast<uint64_t>((now - lastMicros) * speed);
+        lastMicros = now;
+        
+        if (distanceActive && haveCurrent && haveFrame) {
+            // The wheel's travel says where on the current segment the robot
+            // is. Standing-still segments go by time, and a robot held up too
+            // long is pushed along so the run still finishes.
+            clock += advance;
+            uint64_t byDistance;
+            if (distanceToTime(current.timestamp, replayChannels.toUnits(CH_TRAVEL, current.get(CH_TRAVEL)),
+                               frame.timestamp, replayChannels.toUnits(CH_TRAVEL, frame.get(CH_TRAVEL)),
+                               updateTravel(), byDistance)) {
+                if (byDistance > elapsed) elapsed = byDistance;
+            } else {
+                elapsed += advance;
+            }
+            
+            uint64_t maxLagUs = REPLAY_DISTANCE_MAX_LAG_MS * 1000;
+            if (clock > elapsed + maxLagUs) {
+                distanceLagUs += static_cast<uint32_t>(clock - maxLagUs - elapsed);
+                elapsed = clock - maxLagUs;
+            }
+            if (clock < elapsed) clock = elapsed;
+        } else {
+            elapsed += advance;
+            clock = elapsed;
+        }
+        
+        // Woke up more than a period late: carry on from the overdue frame
+        // as if it were due now, delaying the rest of the recording. The
+        // distance timeline isn't late, it's wherever the robot is.
+        if (catchUpPolicy == CatchUpPolicy::TIME_SHIFT && !distanceActive && haveFrame && frame.timestamp <= elapsed) {
+            uint64_t late = elapsed - frame.timestamp;
+            if (late > playbackPeriodMs * 1000 * speed) {
+                elapsed = frame.timestamp;
+                timeShiftUs += static_cast<uint32_t>(late / speed);
+            }
+        }
         
         // Process frames up to current time (using microseconds)
-        while (frameIndex < recording.size() && recording[frameIndex].timestamp <= elapsed) {
-            RecordedFrame& frame = recording[frameIndex];
+        bool newFrame = false;
+        while (haveFrame && frame.timestamp <= elapsed) {
+            current = frame;
+            haveCurrent = true;
             
-            // Get base motor values
-            int left = frame.leftStick;
-            int right = frame.rightStick;
+            // How far behind its (scaled) deadline this frame goes out
+            playbackTiming.add(static_cast<uint32_t>((elapsed - frame.timestamp) / speed) +
+                               static_cast<uint32_t>(pros::micros() - now));
             
-            // Apply IMU heading correction
-            float currentHeading = imu.get_heading();
-            applyHeadingCorrection(left, right, frame.heading, currentHeading);
+            // At a checkpoint, put the robot back where it was recorded before
+            // anything else happens there. The timeline waits for it.
+            uint8_t checkpoint = static_cast<uint8_t>(frame.get(CH_CHECKPOINT));
+            if (resyncActive && checkpoint && !lastCheckpoint && resyncTo(frame)) {
+                // The correction rolled the tracking wheel too - pick travel up from the checkpoint
+                if (distanceActive) {
+                    resetTravel();
+                    travel = replayChannels.toUnits(CH_TRAVEL, frame.get(CH_TRAVEL));
+                }
+                now = pros::micros();
+                lastMicros = now;
+                wakeTime = pros::millis();
+                clock = elapsed;
+            }
+            lastCheckpoint = checkpoint;
             
-            // Apply motor movements
-            left_motors.move(left);
-            right_motors.move(right);
+            // Logged state transitions (or button presses, in older recordings) drive the state machines
+            MechanismEvent fired[MECH_COUNT];
+            uint8_t firedCount = mechanisms.step(frame, frame.timestamp, fired);
+            for (uint8_t i = 0; i < firedCount; i++) {
+                setMechanism(fired[i].output, fired[i].value);
+            }
             
-            // Apply recorded motor power directly
-            Intake.move(frame.intakePower);
-            Outtake.move(frame.outtakePower);
+            haveFrame = source.next(frame);
             
-            // Handle button presses with edge detection for toggle buttons
-            uint8_t currentButtons = frame.buttons;
+            // Registered mechanisms get each overdue frame in turn, unless
+            // coalescing, where only the last command would have stuck anyway.
+            // The newest frame goes out below, once, blended or as recorded.
+            if (haveFrame && frame.timestamp <= elapsed) {
+                if (catchUpPolicy == CatchUpPolicy::COALESCE) coalescedFrames++;
+                else driveMechanisms(current);
+            } else {
+                newFrame = true;
+            }
+        }
+        
+        // Unjam pulse and mid-scoring run on every pass, like opcontrol's update()
+        playbackOuttake.runMidScoring();
+        
+        // Speed for the segment up to the next frame
+        speed = haveCurrent && haveFrame ? segmentSpeed(current, frame) : timeScale;
+        
+        // Filtered battery voltage - a single read sags and spikes with load
+        if (compensating && haveCurrent) {
+            currentMv += 0.1f * (pros::battery::get_voltage() - currentMv);
+            float recordedMv = batteryChannel ? current.get(CH_BATTERY) : info.batteryMv;
+            voltageRatio = recordedMv > 0 && currentMv > 0 ? recordedMv / currentMv : 1.0f;
+            
+            // Don't chase a bad reading
+            if (voltageRatio < 0.75f) voltageRatio = 0.75f;
+            if (voltageRatio > 1.5f) voltageRatio = 1.5f;
+        }
+        
+        // Output for this pass: the latest frame, or a blend towards the next one
+        RecordedFrame output = current;
+        bool blended = interpolatedPlayback && haveCurrent && haveFrame &&
+                       frame.timestamp - current.timestamp <= maxBlendGapUs;
+        if (blended) {
+            replayChannels.interpolate(current, frame, static_cast<uint32_t>(elapsed), output);
+        }
+        
+        // Registered mechanisms: every pass while blending, otherwise when a frame came due
+        if (blended || newFrame) {
+            driveMechanisms(output);
+        }
+        
+        // Drive from the output. Sticks are scaled with the timeline so the
+        // same path is covered in less time.
+        if (haveCurrent) {
+            bool consecutive = haveFrame && frame.timestamp - current.timestamp <= maxBlendGapUs;
+            const RecordedFrame* next = consecutive ? &frame : nullptr;
             
-            // Mid-scoring toggle (X) - still need to handle pneumatic
-            if (wasPressed(currentButtons, prevButtons, BTN_X)) {
-                midScoring = !midScoring;
-                MidScoring.set_value(midScoring);
+            int left, right;
+            if (modelActive) {
+                left = static_cast<int>(std::lround(modelCommand(*findModel(playInfo, CH_LEFT_VEL), output, next, speed)));
+                right = static_cast<int>(std::lround(modelCommand(*findModel(playInfo, CH_RIGHT_VEL), output, next, speed)));
+            } else {
+                left = static_cast<int>(std::lround(driveCommand(output, false) * speed));
+                right = static_cast<int>(std::lround(driveCommand(output, true) * speed));
             }
             
-            // Pneumatics (A = descore, B = unloader)
-            if (wasPressed(currentButtons, prevButtons, BTN_A)) {
-                descore = !descore;
-                Descore.set_value(descore);
+            if (tracking) {
+                // Full pose correction, heading included
+                applyPoseCorrection(left, right, output, next, speed);
             }
-            if (wasPressed(currentButtons, prevButtons, BTN_B)) {
-                unloader = !unloader;
-                Unloader.set_value(unloader);
+            
+            // Same effort as when recorded: scale by the voltage ratio and note when that clips
+            if (compensating) {
+                left = static_cast<int>(std::lround(left * voltageRatio));
+                right = static_cast<int>(std::lround(right * voltageRatio));
+                compensatedPasses++;
+                if (std::abs(left) > 127 || std::abs(right) > 127) saturatedPasses++;
+                if (left > 127) left = 127;
+                if (left < -127) left = -127;
+                if (right > 127) right = 127;
+                if (right < -127) right = -127;
             }
             
-            prevButtons = currentButtons;
-            frameIndex++;
+            // Apply motor movements - in velocity mode the counts map back onto the gearset's speed.
+            // The heading controller adds its correction and drives the motors itself.
+            if (!tracking) {
+                float targetHeading = replayChannels.toUnits(CH_HEADING, output.get(CH_HEADING));
+                headingController.post(targetHeading, left, right);
+            } else if (modelActive) {
+                left_motors.move_voltage(static_cast<int32_t>(std::lround(left * 12000.0f / 127.0f)));
+                right_motors.move_voltage(static_cast<int32_t>(std::lround(right * 12000.0f / 127.0f)));
+            } else if (velocityActive) {
+                left_motors.move_velocity(static_cast<int32_t>(std::lround(left * driveMaxRpm / 127.0f)));
+                right_motors.move_velocity(static_cast<int32_t>(std::lround(right * driveMaxRpm / 127.0f)));
+            } else {
+                left_motors.move(left);
+                right_motors.move(right);
+            }
         }
         
         // Convert to milliseconds for display
         uint32_t elapsedMs = elapsed / 1000;
         
         // Blink green indicator
-        if ((elapsedMs / 500) % 2 == 0) {
-            pros::screen::set_pen(pros::c::COLOR_GREEN);
-        } else {
-            pros::screen::set_pen(pros::c::COLOR_DARK_GREEN);
-        }
-        pros::screen::fill_circle(460, 20, 15);
+        blinkIndicator(elapsedMs, blinkOn);
         
-        pros::delay(5);  // 5ms polling for smoother playback with microsecond timing
-    }
-    
-    // Stop all motors at end
-    left_motors.move(0);
-    right_motors.move(0);
-    Intake.move(0);
-    Outtake.move(0);
-    
-    // Restore normal task priority
-    pros::Task::current().set_priority(TASK_PRIORITY_DEFAULT);
-    
-    _isPlaying = false;
-    _abortRequested = false;
-    
-    if (!_abortRequested) {
-        master.print(0, 0, "REPLAY COMPLETE!   ");
+        if (!haveFrame) break;
+        
+        // Sleep until the next frame is due, or one period at most. Rounded up
+        // to the next millisecond tick so a frame is never woken for early.
+        uint32_t untilDueUs = frame.timestamp > elapsed ? static_cast<uint32_t>((frame.timestamp - elapsed) / speed) : 0;
+        uint32_t dueMs = pros::millis() + (untilDueUs + 999) / 1000;
+        uint32_t step = dueMs > wakeTime ? dueMs - wakeTime : 1;
+        if (step > playbackPeriodMs) step = playbackPeriodMs;
+        pros::Task::delay_until(&wakeTime, step);
     }
     
-    // Clear indicator
-    pros::screen::set_pen(pros::c::COLOR_BLACK);
-    pros::screen::fill_circle(460, 20, 15);
+    lastPlaybackMs = static_cast<uint32_t>((pros::micros() - playStartTime) / 1000);
+    endPlayback();
 }
 
 void AutonReplay::clearRecording() {
     recording.clear();
+    if (!compiledEmbedded) compiledSlot = -1;
     master.print(0, 0, "RECORDING CLEARED  ");
 }
 
 uint32_t AutonReplay::getDuration() const {
-    if (recording.empty()) return 0;
-    // Convert from microseconds to milliseconds
-    return recording.back().timestamp / 1000;
+    return recording.info.durationMs;
 }
 
 bool AutonReplay::saveToSD() {
@@ -332,24 +1318,77 @@ bool AutonReplay::saveToSD() {
         return false;
     }
     
-    FILE* file = fopen(filePath.c_str(), "wb");
+    // A streamed recording that hasn't been loaded back is already on the card
+    if (recording.blocks.empty() && !recording.empty()) {
+        return true;
+    }
+    
+    // Write beside the old recording and only replace it once this one is complete
+    std::string partPath = replayPartPath(filePath.c_str());
+    FILE* file = fopen(partPath.c_str(), "wb");
     if (!file) {
         return false;
     }
     
-    // Write number of frames first
-    uint32_t frameCount = recording.size();
-    fwrite(&frameCount, sizeof(uint32_t), 1, file);
+    // Header + CRC-checked blocks (see replay_format.h)
+    bool ok = writeRecording(file, recording);
+    long fileSize = ftell(file);
     
-    // Write all frames
-    for (const auto& frame : recording) {
-        fwrite(&frame, sizeof(RecordedFrame), 1, file);
+    fclose(file);
+    
+    ok = ok && commitRecording(partPath.c_str(), filePath.c_str());
+    if (ok) {
+        updateLibrary(fileSize > 0 ? fileSize : 0,
+                      replayCrc32(recording.blocks.data(), recording.blocks.size()));
     }
+    return ok;
+}
+
+void AutonReplay::updateLibrary(uint32_t fileSize, uint32_t checksum) {
+    SlotEntry entry;
+    entry.frameCount = recording.info.frameCount;
+    entry.durationMs = recording.info.durationMs;
+    entry.fileSize = fileSize;
+    entry.checksum = checksum;
+    replayLibrary.updateSlot(currentSlot, entry);
+}
+
+void AutonReplay::selectSlot(int slot) {
+    if (!ReplayLibrary::isValidSlot(slot) || _isRecording || _isPlaying) return;
+    if (slot == currentSlot) return;
     
-    fclose(file);
+    currentSlot = slot;
+    filePath = ReplayLibrary::getSlotPath(slot);
+    recording.clear();
+    compiledSlot = -1;
+}
+
+bool AutonReplay::preload(int slot) {
+    selectSlot(slot);
+    if (currentSlot != slot) return false;
+    
+    // Built into the program - nothing to load, only compile
+    if (replayLibrary.hasEmbedded(slot)) {
+        if (compiledSlot != slot || !compiledEmbedded || !compiled.matches(timeScale, maxDriveAccel)) {
+            compileRecording(true);
+        }
+        return true;
+    }
+    
+    // Decoded already, or the index says the slot is empty so don't bother touching the file
+    if (recording.blocks.empty() && (!replayLibrary.hasRecording(slot) || !loadFromSD())) return false;
+    
+    // Too long to compile is fine - playback() just decodes it frame by frame
+    if (compiledSlot != slot || compiledEmbedded || !compiled.matches(timeScale, maxDriveAccel)) {
+        compileRecording(false);
+    }
     return true;
 }
 
+bool AutonReplay::hasRecording() const {
+    return !recording.empty() || replayLibrary.hasRecording(currentSlot);
+}
+
 bool AutonReplay::loadFromSD() {
     // Check SD card first
     if (!isSDCardInserted()) {
@@ -362,33 +1401,17 @@ bool AutonReplay::loadFromSD() {
         return false;
     }
     
-    // Read frame count
-    uint32_t frameCount = 0;
-    if (fread(&frameCount, sizeof(uint32_t), 1, file) != 1) {
-        fclose(file);
-        return false;
-    }
+    // Validates header and every block CRC before touching the current recording
+    bool ok = readRecording(file, recording);
+    fclose(file);
     
-    // Sanity check (max ~15000 frames = 5 minutes at 50Hz)
-    if (frameCount > 15000) {
-        fclose(file);
+    if (!ok) {
+        master.print(0, 0, "BAD RECORDING FILE!");
         return false;
     }
+    if (!compiledEmbedded) compiledSlot = -1;
     
-    // Read all frames
-    recording.clear();
-    recording.resize(frameCount);
-    
-    for (uint32_t i = 0; i < frameCount; i++) {
-        if (fread(&recording[i], sizeof(RecordedFrame), 1, file) != 1) {
-            fclose(file);
-            recording.clear();
-            return false;
-        }
-    }
-    
-    fclose(file);
-    master.print(0, 0, "LOADED: %d frames  ", frameCount);
+    master.print(0, 0, "LOADED: %d frames  ", getFrameCount());
     return true;
 }
 
@@ -411,6 +1434,6 @@ void AutonReplay::drawStatusIndicator() {
         pros::screen::set_pen(pros::c::COLOR_YELLOW);
         pros::screen::fill_circle(460, 20, 15);
         pros::screen::set_pen(pros::c::COLOR_WHITE);
-        pros::screen::print(pros::E_TEXT_SMALL, 360, 10, "%d frm", recording.size());
+        pros::screen::print(pros::E_TEXT_SMALL, 360, 10, "%d frm", getFrameCount());
     }
 }
@@ -0,0 +1,137 @@
+#include "auton_timeline.h"
+#include "robot_config.h"
+
+AutonTimeline::Step* AutonTimeline::add(StepType type) {
+    if (count >= TIMELINE_MAX_STEPS) {
+        overflowed = true;
+        return nullptr;
+    }
+    Step* step = &steps[count++];
+    *step = Step();
+    step->type = type;
+    return step;
+}
+
+AutonTimeline& AutonTimeline::replay(int slot, uint32_t fromMs, uint32_t toMs) {
+    if (Step* step = add(StepType::REPLAY)) {
+        step->slot = slot;
+        step->fromMs = fromMs;
+        step->toMs = toMs;
+    }
+    return *this;
+}
+
+AutonTimeline& AutonTimeline::moveToPoint(float x, float y, int timeout, lemlib::MoveToPointParams params) {
+    if (Step* step = add(StepType::MOVE_TO_POINT)) {
+        step->x = x;
+        step->y = y;
+        step->timeout = timeout;
+        step->pointParams = params;
+    }
+    return *this;
+}
+
+AutonTimeline& AutonTimeline::moveToPose(float x, float y, float theta, int timeout, lemlib::MoveToPoseParams params) {
+    if (Step* step = add(StepType::MOVE_TO_POSE)) {
+        step->x = x;
+        step->y = y;
+        step->theta = theta;
+        step->timeout = timeout;
+        step->poseParams = params;
+    }
+    return *this;
+}
+
+AutonTimeline& AutonTimeline::turnToHeading(float theta, int timeout, lemlib::TurnToHeadingParams params) {
+    if (Step* step = add(StepType::TURN_TO_HEADING)) {
+        step->theta = theta;
+        step->timeout = timeout;
+        step->turnParams = params;
+    }
+    return *this;
+}
+
+AutonTimeline& AutonTimeline::follow(const asset& path, float lookahead, int timeout, bool forwards) {
+    if (Step* step = add(StepType::FOLLOW)) {
+        step->path = &path;
+        step->lookahead = lookahead;
+        step->timeout = timeout;
+        step->forwards = forwards;
+    }
+    return *this;
+}
+
+AutonTimeline& AutonTimeline::mechanism(uint8_t id, bool value) {
+    if (Step* step = add(StepType::MECHANISM)) {
+        step->mechanism = id;
+        step->value = value;
+    }
+    return *this;
+}
+
+AutonTimeline& AutonTimeline::wait(uint32_t ms) {
+    if (Step* step = add(StepType::WAIT)) {
+        step->timeout = static_cast<int>(ms);
+    }
+    return *this;
+}
+
+AutonTimeline& AutonTimeline::call(void (*action)()) {
+    if (Step* step = add(StepType::CALL)) {
+        step->action = action;
+    }
+    return *this;
+}
+
+bool AutonTimeline::runStep(const Step& step, const lemlib::Pose& start) {
+    // LemLib motions are started async and waited on here, so the mechanism
+    // state machines keep running and the emergency stop still works
+    switch (step.type) {
+        case StepType::REPLAY:
+            return autonReplay.playSegment(step.slot, step.fromMs, step.toMs, start);
+        case StepType::MOVE_TO_POINT:
+            chassis.moveToPoint(step.x, step.y, step.timeout, step.pointParams);
+            return autonReplay.waitForMotion();
+        case StepType::MOVE_TO_POSE:
+            chassis.moveToPose(step.x, step.y, step.theta, step.timeout, step.poseParams);
+            return autonReplay.waitForMotion();
+        case StepType::TURN_TO_HEADING:
+            chassis.turnToHeading(step.theta, step.timeout, step.turnParams);
+            return autonReplay.waitForMotion();
+        case StepType::FOLLOW:
+            chassis.follow(*step.path, step.lookahead, step.timeout, step.forwards);
+            return autonReplay.waitForMotion();
+        case StepType::MECHANISM:
+            autonReplay.setMechanism(step.mechanism, step.value);
+            return true;
+        case StepType::WAIT:
+            return autonReplay.waitForMotion(static_cast<uint32_t>(step.timeout));
+        case StepType::CALL:
+            if (step.action) step.action();
+            return true;
+    }
+    return false;
+}
+
+bool AutonTimeline::run() {
+    if (overflowed) {
+        master.print(0, 0, "TIMELINE FULL!     ");
+        return false;
+    }
+
+    // Recordings start from 0,0,0 - on the field, that's where this routine starts
+    lemlib::Pose start = originSet ? origin : chassis.getPose();
+    autonReplay.resetMechanisms();
+
+    bool ok = true;
+    for (uint8_t i = 0; i < count && ok; i++) {
+        ok = runStep(steps[i], start);
+    }
+
+    // Nothing carries on past the end of the routine
+    left_motors.move(0);
+    right_motors.move(0);
+    Intake.move(0);
+    Outtake.move(0);
+    return ok;
+}
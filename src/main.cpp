@@ -4,15 +4,35 @@
 #include "robot_config.h"
 #include "autonomous.h"
 #include "auton_replay.h"
+#include "replay_library.h"
 #include "subsystems/intake.h"
 #include "subsystems/outtake.h"
 #include "subsystems/pneumatics.h"
 
+// Competition recordings built into the program from recordings/*.bin (any that exist)
+REPLAY_ASSET(auton_skills)
+REPLAY_ASSET(auton_left)
+REPLAY_ASSET(auton_right)
+REPLAY_ASSET(auton_r_descore)
+
 void initialize() {
     initializeRobot();
     
-    // Try to load any existing recording from SD card
-    if (autonReplay.loadFromSD()) {
+    // Reserve recording buffers up front so recording never allocates
+    autonReplay.init();
+    
+    // Read the slot index (recovering any recording cut off by a brownout),
+    // then load the selected slot's recording from the SD card
+    int recovered = replayLibrary.init();
+    replayLibrary.embed(0, auton_skills);
+    replayLibrary.embed(1, auton_left);
+    replayLibrary.embed(2, auton_right);
+    replayLibrary.embed(3, auton_r_descore);
+    if (recovered > 0) {
+        pros::screen::set_pen(pros::c::COLOR_YELLOW);
+        pros::screen::print(pros::E_TEXT_MEDIUM, 10, 80, "Recovered %d interrupted recording(s)", recovered);
+    }
+    if (autonReplay.preload(autonSelection) && !replayLibrary.hasEmbedded(autonSelection)) {
         pros::screen::set_pen(pros::c::COLOR_GREEN);
         pros::screen::print(pros::E_TEXT_MEDIUM, 10, 100, "Recording loaded from SD!");
     }
@@ -22,15 +42,38 @@ void initialize() {
 
 void disabled() {}
 
-void competition_initialize() {}
+void competition_initialize() {
+    // Decode and compile the picked slot before the match starts (and again
+    // whenever the pick changes) so autonomous() never waits on the SD card.
+    // Embedded recordings are already in the program and only get compiled.
+    runAutonSelector(0, [](int slot) {
+        autonReplay.preload(slot);
+    });
+}
 
 void autonomous() {
-    // Play back the recorded autonomous
-    autonReplay.playback();
+    // A recording built into the program wins - no SD card needed
+    if (autonReplay.playEmbedded(autonSelection)) return;
+    
+    autonReplay.selectSlot(autonSelection);
+    
+    // Play back the recording for the selected auton if there is one
+    if (autonReplay.hasRecording()) {
+        autonReplay.playback();
+        return;
+    }
+    
+    // Otherwise fall back to the hand-written routine
+    switch (autonSelection) {
+        case 0: skills_auton(); break;
+        case 1: leftAuton(); break;
+        case 2: rightAuton(); break;
+        case 3: rightAutonDescore(); break;
+    }
 }
 
 // Small deadband to prevent drift (applies to values close to 0)
-int applyDeadband(int value, int threshold = 8) {
+int applyDeadband(int value, int threshold = REPLAY_STICK_DEADBAND) {
     return (abs(value) < threshold) ? 0 : value;
 }
 
@@ -60,21 +103,79 @@ void drawReplayMenu() {
     pros::screen::set_pen(pros::c::COLOR_DARK_GRAY);
     pros::screen::fill_rect(20, 160, 460, 220);
     
-    // Show recording info
+    // Show recording info for the current slot (from the index if it isn't loaded)
+    int slot = autonReplay.getSlot();
+    const SlotEntry& entry = replayLibrary.getEntry(slot);
     pros::screen::set_pen(pros::c::COLOR_WHITE);
     if (autonReplay.getFrameCount() > 0) {
         uint32_t duration = autonReplay.getDuration();
         pros::screen::print(pros::E_TEXT_MEDIUM, 30, 175, 
-            "Recording: %d frames (%.1f sec)", 
+            "%s: %d frames (%.1f sec)", 
+            ReplayLibrary::getSlotName(slot),
             autonReplay.getFrameCount(), 
             duration / 1000.0f);
+    } else if (entry.frameCount > 0) {
+        pros::screen::print(pros::E_TEXT_MEDIUM, 30, 175, 
+            "%s: %d frames (%.1f sec) on SD", 
+            ReplayLibrary::getSlotName(slot),
+            (int)entry.frameCount, 
+            entry.durationMs / 1000.0f);
     } else {
-        pros::screen::print(pros::E_TEXT_MEDIUM, 30, 175, "No recording loaded");
+        pros::screen::print(pros::E_TEXT_MEDIUM, 30, 175, "%s: empty", ReplayLibrary::getSlotName(slot));
+    }
+    
+    // Lateness of the last playback's frames
+    const TimingStats& timing = autonReplay.getPlaybackTiming();
+    if (timing.getCount() > 0) {
+        pros::screen::set_pen(pros::c::COLOR_LIGHT_GRAY);
+        pros::screen::print(pros::E_TEXT_SMALL, 30, 45, "Replay %.1fs, late ms: min %.1f mean %.1f p99 %.1f max %.1f",
+            autonReplay.getPlaybackDuration() / 1000.0f, timing.getMinUs() / 1000.0f, timing.getMeanUs() / 1000.0f,
+            timing.getP99Us() / 1000.0f, timing.getMaxUs() / 1000.0f);
+    }
+    
+    // What late wake-ups cost: frames skipped over, or time the timeline slipped
+    if (autonReplay.getCoalescedFrames() > 0 || autonReplay.getTimeShiftMs() > 0) {
+        pros::screen::set_pen(pros::c::COLOR_LIGHT_GRAY);
+        pros::screen::print(pros::E_TEXT_SMALL, 30, 210, "Catch-up: %d frames coalesced, %dms shifted",
+            (int)autonReplay.getCoalescedFrames(), (int)autonReplay.getTimeShiftMs());
     }
     
+    // How long distance-indexed playback waited on a robot that wasn't getting there
+    if (autonReplay.getDistanceLagMs() > 0) {
+        pros::screen::set_pen(pros::c::COLOR_LIGHT_GRAY);
+        pros::screen::print(pros::E_TEXT_SMALL, 30, 160, "Distance lag limit: %dms",
+            (int)autonReplay.getDistanceLagMs());
+    }
+    
+    // Checkpoint corrections, and how long they held the run up
+    if (timing.getCount() > 0 && autonReplay.getResyncCount() > 0) {
+        pros::screen::set_pen(pros::c::COLOR_LIGHT_GRAY);
+        pros::screen::print(pros::E_TEXT_SMALL, 250, 160, "Re-synced %d times (%.1fs)",
+            (int)autonReplay.getResyncCount(), autonReplay.getResyncMs() / 1000.0f);
+    }
+    
+    // How far pose tracking let the robot stray from the recorded path
+    if (timing.getCount() > 0 && autonReplay.getMaxPoseError() > 0) {
+        pros::screen::set_pen(pros::c::COLOR_LIGHT_GRAY);
+        pros::screen::print(pros::E_TEXT_SMALL, 30, 145, "Pose error max %.1f in", autonReplay.getMaxPoseError());
+    }
+    
+    // How often battery compensation asked for more than full power
+    if (timing.getCount() > 0 && autonReplay.getSaturation() > 0) {
+        pros::screen::set_pen(pros::c::COLOR_LIGHT_GRAY);
+        pros::screen::print(pros::E_TEXT_SMALL, 250, 145, "Volt comp %d%% saturated",
+            (int)(autonReplay.getSaturation() * 100));
+    }
+    
+    // Recording memory: arena carved at startup and the RAM buffer's high-water mark
+    pros::screen::set_pen(pros::c::COLOR_LIGHT_GRAY);
+    pros::screen::print(pros::E_TEXT_SMALL, 30, 225, "Mem: %dKB arena / %dKB, buffer peak %d/%dKB",
+        (int)(replayArena.getUsed() / 1024), (int)(replayArena.getCapacity() / 1024),
+        (int)(autonReplay.getBufferPeak() / 1024), (int)(autonReplay.getBufferCapacity() / 1024));
+    
     // Instructions
     pros::screen::set_pen(pros::c::COLOR_YELLOW);
-    pros::screen::print(pros::E_TEXT_SMALL, 30, 195, "Touch RECORD, drive, touch STOP when done");
+    pros::screen::print(pros::E_TEXT_SMALL, 30, 195, "Touch RECORD, drive, touch STOP. Tap here: next slot");
 }
 
 // Handle touch input for the menu
@@ -108,6 +209,11 @@ void handleMenuTouch() {
                 drawReplayMenu();  // Redraw after playback
             }
         }
+        // Status area cycles through the library slots
+        else if (y >= 160 && y <= 220 && !autonReplay.isRecording()) {
+            autonReplay.preload((autonReplay.getSlot() + 1) % REPLAY_SLOT_COUNT);
+            drawReplayMenu();
+        }
         
         pros::delay(200);  // Debounce
     }
@@ -117,6 +223,7 @@ void opcontrol() {
     IntakeControl intake;
     OuttakeControl outtake;
     PneumaticControl pneumatics;
+    autonReplay.attachMechanisms(&outtake, &pneumatics);
 
     while (true) {
         // Handle menu touch
@@ -149,10 +256,22 @@ void opcontrol() {
             }
         }
         
+        // Hold Y and press DOWN to calibrate actuator latency - it drives the robot,
+        // so it takes both hands (robot on the ground, nothing in the way)
         if (master.get_digital_new_press(pros::E_CONTROLLER_DIGITAL_DOWN)) {
             if (autonReplay.isRecording()) {
                 autonReplay.stopRecording(true);
                 drawReplayMenu();
+            } else if (master.get_digital(pros::E_CONTROLLER_DIGITAL_Y) && !autonReplay.isPlaying()) {
+                autonReplay.calibrateLatency();
+            }
+        }
+        
+        // Y marks a checkpoint while recording (RIGHT is half of the emergency stop)
+        if (master.get_digital_new_press(pros::E_CONTROLLER_DIGITAL_Y)) {
+            if (autonReplay.isRecording()) {
+                autonReplay.markCheckpoint();
+                master.rumble(".");
             }
         }
         
@@ -0,0 +1,64 @@
+#include "replay_arena.h"
+#include <cstring>
+
+// Global instance
+ReplayArena replayArena;
+
+// In .bss: reserved when the program loads, never touched by the heap
+alignas(8) static uint8_t arenaStorage[REPLAY_ARENA_SIZE];
+
+void* ReplayArena::allocate(size_t size, size_t align) noexcept {
+    size_t start = (used + align - 1) & ~(align - 1);
+    if (start > REPLAY_ARENA_SIZE || size > REPLAY_ARENA_SIZE - start) return nullptr;
+
+    used = start + size;
+    return arenaStorage + start;
+}
+
+bool ByteBuffer::reserve(size_t capacity) noexcept {
+    if (capacity <= cap) return true;
+
+    uint8_t* region = static_cast<uint8_t*>(replayArena.allocate(capacity));
+    if (!region) return false;
+
+    if (length > 0) memcpy(region, bytes, length);
+    bytes = region;
+    cap = capacity;
+    return true;
+}
+
+bool ByteBuffer::push_back(uint8_t b) noexcept {
+    if (length >= cap) {
+        overflow = true;
+        return false;
+    }
+    bytes[length++] = b;
+    if (length > peak) peak = length;
+    return true;
+}
+
+bool ByteBuffer::append(const uint8_t* src, size_t count) noexcept {
+    if (count > cap - length) {
+        overflow = true;
+        return false;
+    }
+    memcpy(bytes + length, src, count);
+    length += count;
+    if (length > peak) peak = length;
+    return true;
+}
+
+bool ByteBuffer::resize(size_t size) noexcept {
+    if (size > cap) {
+        overflow = true;
+        return false;
+    }
+    length = size;
+    if (length > peak) peak = length;
+    return true;
+}
+
+void ByteBuffer::truncate(size_t size) noexcept {
+    if (size < length) length = size;
+    overflow = false;
+}
@@ -0,0 +1,141 @@
+#include "replay_channels.h"
+#include <cmath>
+
+// Global instance - constant-initialized, so it's ready before any constructor runs
+ChannelRegistry replayChannels;
+
+bool ChannelRegistry::add(const ChannelDef& def) {
+    if (count >= REPLAY_MAX_CHANNELS || def.id >= REPLAY_MAX_CHANNELS) return false;
+    if (channelTypeSize(def.type) == 0 || find(def.id)) return false;
+
+    defs[count++] = def;
+    return true;
+}
+
+const ChannelDef* ChannelRegistry::find(uint8_t id) const {
+    for (uint8_t i = 0; i < count; i++) {
+        if (defs[i].id == id) return &defs[i];
+    }
+    return nullptr;
+}
+
+void ChannelRegistry::describe(RecordingInfo& info) const {
+    info.channelCount = count;
+    for (uint8_t i = 0; i < count; i++) {
+        info.channels[i].id = defs[i].id;
+        info.channels[i].type = defs[i].type;
+        info.channels[i].modulus = defs[i].modulus;
+        info.channels[i].secondOrder = defs[i].secondOrder;
+    }
+}
+
+void ChannelRegistry::sample(RecordedFrame& frame) const {
+    for (uint8_t i = 0; i < count; i++) {
+        if (defs[i].sample) frame.set(defs[i].id, defs[i].sample());
+    }
+}
+
+void ChannelRegistry::apply(const RecordedFrame& frame) const {
+    for (uint8_t i = 0; i < count; i++) {
+        if (defs[i].apply) defs[i].apply(frame.get(defs[i].id));
+    }
+}
+
+bool ChannelRegistry::hasApply() const {
+    for (uint8_t i = 0; i < count; i++) {
+        if (defs[i].apply) return true;
+    }
+    return false;
+}
+
+void ChannelRegistry::interpolate(const RecordedFrame& from, const RecordedFrame& to, uint32_t time,
+                                  RecordedFrame& out) const {
+    out = from;
+    out.timestamp = time;
+    if (to.timestamp <= from.timestamp || time <= from.timestamp) return;
+
+    float t = static_cast<float>(time - from.timestamp) / (to.timestamp - from.timestamp);
+    if (t > 1.0f) t = 1.0f;
+
+    for (uint8_t i = 0; i < count; i++) {
+        const ChannelDef& def = defs[i];
+        if (!def.interpolate || def.id == CH_TIMESTAMP) continue;
+
+        int32_t start = from.get(def.id);
+        int32_t diff = to.get(def.id) - start;
+        if (def.modulus != 0) {
+            // Shortest way round, e.g. 359 -> 1 degrees goes through 0
+            if (diff > def.modulus / 2) diff -= def.modulus;
+            if (diff < -def.modulus / 2) diff += def.modulus;
+        }
+
+        int32_t value = start + static_cast<int32_t>(std::lround(diff * t));
+        if (def.modulus != 0) {
+            value %= def.modulus;
+            if (value < 0) value += def.modulus;
+        }
+        out.set(def.id, value);
+    }
+}
+
+int32_t ChannelRegistry::toRaw(uint8_t id, float units) const {
+    const ChannelDef* def = find(id);
+    if (!def) return 0;
+
+    int32_t raw = static_cast<int32_t>(std::lround(units / def->scale));
+    if (def->modulus != 0) {
+        raw %= def->modulus;
+        if (raw < 0) raw += def->modulus;
+    }
+    return raw;
+}
+
+float ChannelRegistry::toUnits(uint8_t id, int32_t raw) const {
+    const ChannelDef* def = find(id);
+    return def ? raw * def->scale : 0.0f;
+}
+
+// --------------------- ChangeFilter ---------------------
+
+void ChangeFilter::begin(uint32_t keyframeMs) {
+    haveHeld = false;
+    haveSkipped = false;
+    keyframeUs = keyframeMs * 1000;
+}
+
+bool ChangeFilter::accept(RecordedFrame& frame) {
+    // Always keep the first frame - it is the starting state
+    bool keep = !haveHeld || (keyframeUs > 0 && frame.timestamp - held.timestamp >= keyframeUs);
+
+    for (uint8_t i = 0; i < replayChannels.size(); i++) {
+        const ChannelDef& def = replayChannels.get(i);
+        if (def.id == CH_TIMESTAMP || !haveHeld) continue;
+
+        int32_t diff = frame.get(def.id) - held.get(def.id);
+        if (diff < 0) diff = -diff;
+        if (def.modulus != 0 && diff > def.modulus / 2) diff = def.modulus - diff;
+
+        if (diff > def.threshold) {
+            keep = true;
+        } else {
+            frame.set(def.id, held.get(def.id));
+        }
+    }
+
+    if (keep) {
+        held = frame;
+        haveHeld = true;
+        haveSkipped = false;
+    } else {
+        skipped = frame;
+        haveSkipped = true;
+    }
+    return keep;
+}
+
+bool ChangeFilter::tail(RecordedFrame& frame) {
+    if (!haveSkipped) return false;
+    frame = skipped;
+    haveSkipped = false;
+    return true;
+}
@@ -0,0 +1,175 @@
+#include "replay_commands.h"
+#include "replay_arena.h"
+#include "replay_channels.h"
+#include "replay_feedforward.h"
+#include <cmath>
+
+// Button and CH_MECHANISMS bit behind each mechanism, indexed by MechanismId
+static const uint8_t MECHANISM_BUTTONS[MECH_COUNT] = {BTN_X, BTN_A, BTN_B};
+static const uint8_t MECHANISM_STATES[MECH_COUNT] = {MECH_STATE_MID_SCORING, MECH_STATE_DESCORE, MECH_STATE_UNLOADER};
+
+static int8_t clampCounts(float value) {
+    long counts = std::lround(value);
+    if (counts > 127) counts = 127;
+    if (counts < -127) counts = -127;
+    return static_cast<int8_t>(counts);
+}
+
+uint8_t MechanismTracker::step(const RecordedFrame& frame, uint32_t time, MechanismEvent* out) {
+    uint8_t buttons = static_cast<uint8_t>(frame.get(CH_BUTTONS));
+    uint8_t logged = static_cast<uint8_t>(frame.get(CH_MECHANISMS));
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; i < MECH_COUNT; i++) {
+        bool changed;
+        if (fromStates) {
+            changed = ((logged & MECHANISM_STATES[i]) != 0) != (((states >> i) & 1) != 0);
+        } else {
+            uint8_t mask = 1 << MECHANISM_BUTTONS[i];
+            changed = (buttons & mask) && !(prevButtons & mask);
+        }
+
+        if (changed) {
+            states ^= 1 << i;
+            out[count++] = {time, i, static_cast<uint8_t>((states >> i) & 1)};
+        }
+    }
+    prevButtons = buttons;
+    return count;
+}
+
+uint8_t MechanismTracker::getStateBits() const {
+    uint8_t bits = 0;
+    for (uint8_t i = 0; i < MECH_COUNT; i++) {
+        if ((states >> i) & 1) bits |= MECHANISM_STATES[i];
+    }
+    return bits;
+}
+
+bool SegmentSource::begin(FrameSource& frames, uint32_t fromMs, uint32_t toMs) {
+    source = &frames;
+    toUs = toMs >= UINT32_MAX / 1000 ? UINT32_MAX : toMs * 1000;
+    mechanisms.reset(hasChannel(frames.getInfo(), CH_MECHANISMS));
+    
+    // Mechanism changes before the segment still count - it starts in the state they left
+    uint32_t fromUs = fromMs >= UINT32_MAX / 1000 ? UINT32_MAX : fromMs * 1000;
+    MechanismEvent skipped[MECH_COUNT];
+    done = true;
+    while (frames.next(start)) {
+        if (start.timestamp >= fromUs) {
+            done = start.timestamp > toUs;
+            break;
+        }
+        mechanisms.step(start, start.timestamp, skipped);
+    }
+    
+    travelBase = start.get(CH_TRAVEL);
+    startPending = !done;
+    return !done;
+}
+
+void SegmentSource::rebase(RecordedFrame& frame) const {
+    frame.timestamp -= start.timestamp;
+    frame.set(CH_TRAVEL, frame.get(CH_TRAVEL) - travelBase);
+}
+
+bool SegmentSource::next(RecordedFrame& frame) {
+    if (done) return false;
+    
+    if (startPending) {
+        startPending = false;
+        frame = start;
+    } else if (!source->next(frame) || frame.timestamp > toUs) {
+        done = true;
+        return false;
+    }
+    rebase(frame);
+    return true;
+}
+
+float scaledSegmentSpeed(const float from[2], const float to[2], float dt, float timeScale, float maxAccel) {
+    // Scaling time by s scales drive commands by s and their rate of change by
+    // s squared. Back off towards real time wherever either would be too much.
+    float speed = timeScale;
+    if (speed <= 1.0f) return speed;
+
+    for (int side = 0; side < 2; side++) {
+        float value = std::fabs(from[side]);
+        if (value * speed > 127.0f) speed = 127.0f / value;
+
+        float rate = dt > 0 ? std::fabs(to[side] - from[side]) / dt : 0.0f;
+        if (maxAccel > 0 && rate * speed * speed > maxAccel) speed = std::sqrt(maxAccel / rate);
+    }
+    return speed > 1.0f ? speed : 1.0f;
+}
+
+bool CommandStream::prepare(size_t maxCommands) {
+    if (commandCapacity >= maxCommands) return true;
+
+    commands = static_cast<PlaybackCommand*>(replayArena.allocate(maxCommands * sizeof(PlaybackCommand)));
+    events = static_cast<MechanismEvent*>(replayArena.allocate(REPLAY_MAX_EVENTS * sizeof(MechanismEvent)));
+    if (!commands || !events) {
+        commands = nullptr;
+        events = nullptr;
+        return false;
+    }
+    commandCapacity = maxCommands;
+    return true;
+}
+
+bool CommandStream::compile(FrameSource& source, float timeScale, float maxAccel) {
+    clear();
+    this->timeScale = timeScale;
+    this->maxAccel = maxAccel;
+    if (!commands) return false;
+
+    MechanismTracker mechanisms;
+    mechanisms.reset(hasChannel(source.getInfo(), CH_MECHANISMS));
+    RecordedFrame frame;
+    RecordedFrame next;
+    bool haveFrame = source.next(frame);
+    double time = 0;    // Playback time of frame (microseconds)
+
+    while (haveFrame) {
+        if (commandCount == commandCapacity) {
+            clear();
+            return false;
+        }
+        bool haveNext = source.next(next);
+
+        // Speed for the segment up to the next frame, exactly as live playback picks it
+        float sticks[2] = {appliedCommand(CH_LEFT_STICK, frame.get(CH_LEFT_STICK)),
+                           appliedCommand(CH_RIGHT_STICK, frame.get(CH_RIGHT_STICK))};
+        float speed = timeScale;
+        if (haveNext) {
+            float nextSticks[2] = {appliedCommand(CH_LEFT_STICK, next.get(CH_LEFT_STICK)),
+                                   appliedCommand(CH_RIGHT_STICK, next.get(CH_RIGHT_STICK))};
+            speed = scaledSegmentSpeed(sticks, nextSticks, (next.timestamp - frame.timestamp) / 1e6f, timeScale, maxAccel);
+        }
+
+        PlaybackCommand& command = commands[commandCount++];
+        command.time = static_cast<uint32_t>(time);
+        command.left = clampCounts(sticks[0] * speed);
+        command.right = clampCounts(sticks[1] * speed);
+        command.intake = clampCounts(frame.get(CH_INTAKE));
+        command.outtake = clampCounts(frame.get(CH_OUTTAKE));
+        command.heading = static_cast<uint16_t>(frame.get(CH_HEADING));
+
+        MechanismEvent fired[MECH_COUNT];
+        uint8_t firedCount = mechanisms.step(frame, command.time, fired);
+        for (uint8_t i = 0; i < firedCount; i++) {
+            if (eventCount == REPLAY_MAX_EVENTS) {
+                clear();
+                return false;
+            }
+            events[eventCount++] = fired[i];
+        }
+
+        if (haveNext) time += (next.timestamp - frame.timestamp) / speed;
+        frame = next;
+        haveFrame = haveNext;
+    }
+
+    valid = true;
+    return true;
+}
@@ -0,0 +1,128 @@
+#include "replay_feedforward.h"
+#include "replay_channels.h"
+#include <cmath>
+
+// Below this the actuator is treated as stopped - static friction makes those
+// samples say nothing useful about kS/kV/kA
+constexpr float MIN_FIT_RPM = 5.0f;
+
+// Command channel (stored as +-127 of nominal voltage) and the velocity it drives
+struct ActuatorChannels {
+    uint8_t command;
+    uint8_t velocity;
+};
+
+static const ActuatorChannels actuators[] = {
+    {CH_LEFT_STICK, CH_LEFT_VEL},
+    {CH_RIGHT_STICK, CH_RIGHT_VEL},
+    {CH_INTAKE, CH_INTAKE_VEL},
+    {CH_OUTTAKE, CH_OUTTAKE_VEL},
+};
+static_assert(sizeof(actuators) / sizeof(actuators[0]) <= REPLAY_MAX_MODELS, "More actuators than model slots");
+
+static float sign(float v) {
+    return v > 0 ? 1.0f : (v < 0 ? -1.0f : 0.0f);
+}
+
+float appliedCommand(uint8_t channel, int32_t value) {
+    bool stick = channel == CH_LEFT_STICK || channel == CH_RIGHT_STICK;
+    if (stick && value > -REPLAY_STICK_DEADBAND && value < REPLAY_STICK_DEADBAND) return 0.0f;
+    if (value > 127) return 127.0f;
+    if (value < -127) return -127.0f;
+    return static_cast<float>(value);
+}
+
+void FeedforwardFit::add(float volts, float velocity, float acceleration) {
+    double x[3] = {sign(velocity), velocity, acceleration};
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) xtx[i][j] += x[i] * x[j];
+        xty[i] += x[i] * volts;
+    }
+    count++;
+}
+
+bool FeedforwardFit::solve(ActuatorModel& model) const {
+    if (count < MIN_SAMPLES) return false;
+
+    // Gaussian elimination with partial pivoting on the augmented normal equations
+    double m[3][4];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) m[i][j] = xtx[i][j];
+        m[i][3] = xty[i];
+    }
+
+    for (int col = 0; col < 3; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < 3; row++) {
+            if (std::fabs(m[row][col]) > std::fabs(m[pivot][col])) pivot = row;
+        }
+        // Relative to the diagonal's size - the columns have very different units
+        if (std::fabs(m[pivot][col]) < 1e-9 * (std::fabs(xtx[col][col]) + 1e-12)) return false;
+
+        for (int j = 0; j < 4; j++) {
+            double t = m[col][j];
+            m[col][j] = m[pivot][j];
+            m[pivot][j] = t;
+        }
+        for (int row = 0; row < 3; row++) {
+            if (row == col) continue;
+            double f = m[row][col] / m[col][col];
+            for (int j = col; j < 4; j++) m[row][j] -= f * m[col][j];
+        }
+    }
+
+    model.kS = static_cast<float>(m[0][3] / m[0][0]);
+    model.kV = static_cast<float>(m[1][3] / m[1][1]);
+    model.kA = static_cast<float>(m[2][3] / m[2][2]);
+    return std::isfinite(model.kS) && std::isfinite(model.kV) && std::isfinite(model.kA);
+}
+
+float feedforwardVolts(const ActuatorModel& model, float velocity, float acceleration) {
+    return model.kS * sign(velocity) + model.kV * velocity + model.kA * acceleration;
+}
+
+int fitFeedforward(FrameSource& source, RecordingInfo& info) {
+    const RecordingInfo& layout = source.getInfo();
+    constexpr int ACTUATOR_COUNT = sizeof(actuators) / sizeof(actuators[0]);
+
+    bool present[ACTUATOR_COUNT];
+    FeedforwardFit fits[ACTUATOR_COUNT];
+    for (int i = 0; i < ACTUATOR_COUNT; i++) {
+        present[i] = hasChannel(layout, actuators[i].command) && hasChannel(layout, actuators[i].velocity);
+    }
+
+    // Each pair of consecutive frames is one sample: the command at the first,
+    // against the mean velocity and the acceleration over the gap
+    uint32_t maxGapUs = layout.samplePeriodMs * 2000;
+    RecordedFrame prev, frame;
+    bool havePrev = source.next(prev);
+    while (havePrev && source.next(frame)) {
+        uint32_t gap = frame.timestamp - prev.timestamp;
+        if (gap > 0 && gap <= maxGapUs) {
+            float dt = gap / 1e6f;
+            for (int i = 0; i < ACTUATOR_COUNT; i++) {
+                if (!present[i]) continue;
+                uint8_t vel = actuators[i].velocity;
+                float v0 = replayChannels.toUnits(vel, prev.get(vel));
+                float v1 = replayChannels.toUnits(vel, frame.get(vel));
+                float v = (v0 + v1) / 2;
+                if (std::fabs(v) < MIN_FIT_RPM) continue;
+
+                uint8_t command = actuators[i].command;
+                float volts = appliedCommand(command, prev.get(command)) * REPLAY_NOMINAL_VOLTS / 127.0f;
+                fits[i].add(volts, v, (v1 - v0) / dt);
+            }
+        }
+        prev = frame;
+    }
+
+    info.modelCount = 0;
+    for (int i = 0; i < ACTUATOR_COUNT; i++) {
+        ActuatorModel model;
+        model.channel = actuators[i].velocity;
+        if (present[i] && fits[i].solve(model)) {
+            info.models[info.modelCount++] = model;
+        }
+    }
+    return info.modelCount;
+}
@@ -0,0 +1,956 @@
+#include "replay_format.h"
+#include "replay_channels.h"
+#include <cmath>
+#include <cstring>
+
+// --------------------- Little-endian helpers ---------------------
+
+void putLE16(std::vector<uint8_t>& out, uint16_t v) {
+    out.push_back(v & 0xFF);
+    out.push_back((v >> 8) & 0xFF);
+}
+
+void putLE32(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back(v & 0xFF);
+    out.push_back((v >> 8) & 0xFF);
+    out.push_back((v >> 16) & 0xFF);
+    out.push_back((v >> 24) & 0xFF);
+}
+
+void putLE16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+void putLE32(uint8_t* p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+uint16_t getLE16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t getLE32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static void putLEFloat(std::vector<uint8_t>& out, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    putLE32(out, bits);
+}
+
+static float getLEFloat(const uint8_t* p) {
+    uint32_t bits = getLE32(p);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// --------------------- CRC32 ---------------------
+
+struct Crc32Table {
+    uint32_t entries[256];
+    constexpr Crc32Table() : entries() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+static constexpr Crc32Table crcTable;
+
+uint32_t replayCrc32(const uint8_t* data, size_t length, uint32_t crc) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = crcTable.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// --------------------- Channels ---------------------
+
+size_t channelTypeSize(uint8_t type) {
+    switch (type) {
+        case CHT_U8:
+        case CHT_I8:  return 1;
+        case CHT_U16:
+        case CHT_I16: return 2;
+        case CHT_U32:
+        case CHT_I32: return 4;
+        default:      return 0;  // Unknown type - file can't be decoded
+    }
+}
+
+void initRecordingInfo(RecordingInfo& info) {
+    info = RecordingInfo();
+    replayChannels.describe(info);
+}
+
+bool hasChannel(const RecordingInfo& info, uint8_t id) {
+    for (uint8_t i = 0; i < info.channelCount; i++) {
+        if (info.channels[i].id == id) return true;
+    }
+    return false;
+}
+
+size_t packedFrameSize(const RecordingInfo& info) {
+    size_t size = 0;
+    for (uint8_t i = 0; i < info.channelCount; i++) {
+        size += channelTypeSize(info.channels[i].type);
+    }
+    return size;
+}
+
+// Read one channel's raw value out of a frame
+static int32_t getChannelValue(const RecordedFrame& frame, uint8_t id) {
+    return id == CH_TIMESTAMP ? static_cast<int32_t>(frame.timestamp) : frame.get(id);
+}
+
+// Write one channel's raw value back into a frame
+static void setChannelValue(RecordedFrame& frame, uint8_t id, int32_t value) {
+    if (id == CH_TIMESTAMP) frame.timestamp = static_cast<uint32_t>(value);
+    else frame.set(id, value);
+}
+
+// Files before v11 don't store decode parameters. Their built-in channels
+// used these: the timestamp is delta-of-delta, the heading wraps at 360 deg.
+static void legacyChannelParams(ChannelEntry& entry) {
+    entry.modulus = entry.id == CH_HEADING ? 36000 : 0;
+    entry.secondOrder = entry.id == CH_TIMESTAMP;
+}
+
+// CH_USER_FIRST of each format version, v1 first. A registered channel
+// keeps its place among the registered channels, so an ID from there up in an
+// older file moves up by however many built-in IDs were added since.
+static const uint8_t USER_FIRST_BY_VERSION[] = {7, 7, 7, 9, 13, 14, 14, 15, 16, 17, 17};
+static_assert(sizeof(USER_FIRST_BY_VERSION) == REPLAY_VERSION,
+              "Add the new version's CH_USER_FIRST when bumping REPLAY_VERSION");
+
+static uint8_t currentChannelId(uint16_t version, uint8_t id) {
+    uint8_t userFirst = USER_FIRST_BY_VERSION[version - 1];
+    return id < userFirst ? id : id - userFirst + CH_USER_FIRST;
+}
+
+static int32_t wrapDelta(int32_t delta, int32_t modulus) {
+    if (modulus == 0) return delta;
+    delta %= modulus;
+    if (delta >= modulus / 2) delta -= modulus;
+    if (delta < -modulus / 2) delta += modulus;
+    return delta;
+}
+
+static int32_t wrapValue(int32_t value, int32_t modulus) {
+    if (modulus == 0) return value;
+    value %= modulus;
+    if (value < 0) value += modulus;
+    return value;
+}
+
+static void storeValue(uint8_t* p, uint8_t type, int32_t value) {
+    uint32_t v = static_cast<uint32_t>(value);
+    for (size_t i = 0; i < channelTypeSize(type); i++) {
+        p[i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+static void putValue(ByteBuffer& out, uint8_t type, int32_t value) {
+    uint8_t bytes[4];
+    storeValue(bytes, type, value);
+    out.append(bytes, channelTypeSize(type));
+}
+
+static int32_t getValue(const uint8_t* p, uint8_t type) {
+    switch (type) {
+        case CHT_U8:  return p[0];
+        case CHT_I8:  return static_cast<int8_t>(p[0]);
+        case CHT_U16: return getLE16(p);
+        case CHT_I16: return static_cast<int16_t>(getLE16(p));
+        case CHT_U32:
+        case CHT_I32: return static_cast<int32_t>(getLE32(p));
+        default:      return 0;
+    }
+}
+
+// --------------------- ColumnBlock ---------------------
+
+bool ColumnBlock::init(const RecordingInfo& recordingInfo, uint16_t blockCapacity) {
+    info = &recordingInfo;
+    capacity = blockCapacity;
+    count = 0;
+
+    uint32_t offset = 0;
+    for (uint8_t c = 0; c < info->channelCount; c++) {
+        offsets[c] = offset;
+        offset += channelTypeSize(info->channels[c].type) * capacity;
+    }
+
+    if (offset > storageSize) {
+        storage = static_cast<uint8_t*>(replayArena.allocate(offset));
+        storageSize = storage ? offset : 0;
+    }
+    if (!storage) {
+        capacity = 0;
+        return false;
+    }
+    return true;
+}
+
+bool ColumnBlock::push(const RecordedFrame& frame) {
+    if (count >= capacity) return false;
+
+    for (uint8_t c = 0; c < info->channelCount; c++) {
+        uint8_t type = info->channels[c].type;
+        uint8_t* p = storage + offsets[c] + count * channelTypeSize(type);
+        storeValue(p, type, getChannelValue(frame, info->channels[c].id));
+    }
+    count++;
+    return true;
+}
+
+int32_t ColumnBlock::value(uint8_t column, uint16_t index) const {
+    uint8_t type = info->channels[column].type;
+    return getValue(storage + offsets[column] + index * channelTypeSize(type), type);
+}
+
+void ColumnBlock::getFrame(uint16_t index, RecordedFrame& frame) const {
+    frame = RecordedFrame();
+    for (uint8_t c = 0; c < info->channelCount; c++) {
+        setChannelValue(frame, info->channels[c].id, value(c, index));
+    }
+}
+
+// --------------------- Header ---------------------
+
+// Header size for a format version and channel count
+static size_t channelEntrySize(uint16_t version) {
+    return version >= 11 ? REPLAY_CHANNEL_ENTRY_SIZE : REPLAY_LEGACY_CHANNEL_ENTRY_SIZE;
+}
+
+static size_t headerSizeFor(uint16_t version, uint8_t channelCount) {
+    size_t size = REPLAY_FILE_HEADER_SIZE + channelCount * channelEntrySize(version) + sizeof(uint32_t);
+    if (version >= 7) size += 1 + REPLAY_MAX_MODELS * REPLAY_MODEL_ENTRY_SIZE;
+    return size;
+}
+
+const ActuatorModel* findModel(const RecordingInfo& info, uint8_t channel) {
+    for (uint8_t i = 0; i < info.modelCount; i++) {
+        if (info.models[i].channel == channel) return &info.models[i];
+    }
+    return nullptr;
+}
+
+void writeRecordingHeader(const RecordingInfo& info, std::vector<uint8_t>& out) {
+    // Always the current layout, even when re-writing an older file's header
+    size_t start = out.size();
+    uint16_t headerSize = headerSizeFor(REPLAY_VERSION, info.channelCount);
+
+    putLE32(out, REPLAY_MAGIC);
+    putLE16(out, REPLAY_VERSION);
+    putLE16(out, headerSize);
+    putLE16(out, info.samplePeriodMs);
+    putLE16(out, info.framesPerBlock);
+    putLE32(out, info.frameCount);
+    putLE32(out, info.durationMs);
+    out.push_back(info.channelCount);
+    out.push_back(info.flags);
+    putLE16(out, info.batteryMv);  // Reserved (0) before battery logging
+
+    for (uint8_t i = 0; i < info.channelCount; i++) {
+        out.push_back(info.channels[i].id);
+        out.push_back(info.channels[i].type);
+        out.push_back(info.channels[i].secondOrder ? 1 : 0);
+        putLE32(out, static_cast<uint32_t>(info.channels[i].modulus));
+    }
+
+    // Unused model slots are zeroed
+    uint8_t modelCount = info.modelCount < REPLAY_MAX_MODELS ? info.modelCount : REPLAY_MAX_MODELS;
+    out.push_back(modelCount);
+    for (uint8_t i = 0; i < REPLAY_MAX_MODELS; i++) {
+        ActuatorModel model = i < modelCount ? info.models[i] : ActuatorModel();
+        out.push_back(model.channel);
+        putLEFloat(out, model.kS);
+        putLEFloat(out, model.kV);
+        putLEFloat(out, model.kA);
+    }
+
+    putLE32(out, replayCrc32(out.data() + start, out.size() - start));
+}
+
+// Parse and validate a complete header held in memory. Returns its size, or 0 if it's bad.
+static size_t parseRecordingHeader(const uint8_t* buf, size_t size, RecordingInfo& info) {
+    if (size < REPLAY_FILE_HEADER_SIZE || getLE32(buf) != REPLAY_MAGIC) return 0;
+
+    info.version = getLE16(buf + 4);
+    uint16_t headerSize = getLE16(buf + 6);
+    info.samplePeriodMs = getLE16(buf + 8);
+    info.framesPerBlock = getLE16(buf + 10);
+    info.frameCount = getLE32(buf + 12);
+    info.durationMs = getLE32(buf + 16);
+    info.channelCount = buf[20];
+    info.flags = buf[21];
+    info.batteryMv = getLE16(buf + 22);
+
+    if (info.version == 0 || info.version > REPLAY_VERSION) return 0;
+    if (info.channelCount == 0 || info.channelCount > REPLAY_MAX_CHANNELS) return 0;
+    if (headerSize != headerSizeFor(info.version, info.channelCount)) return 0;
+    if (size < headerSize) return 0;
+
+    uint32_t storedCrc = getLE32(buf + headerSize - 4);
+    if (replayCrc32(buf, headerSize - 4) != storedCrc) return 0;
+
+    size_t entrySize = channelEntrySize(info.version);
+    for (uint8_t i = 0; i < info.channelCount; i++) {
+        const uint8_t* entry = buf + REPLAY_FILE_HEADER_SIZE + i * entrySize;
+        ChannelEntry& channel = info.channels[i];
+        channel.id = currentChannelId(info.version, entry[0]);
+        channel.type = entry[1];
+        if (channel.id >= REPLAY_MAX_CHANNELS || channelTypeSize(entry[1]) == 0) return 0;
+
+        if (info.version >= 11) {
+            channel.secondOrder = entry[2] & 1;
+            channel.modulus = static_cast<int32_t>(getLE32(entry + 3));
+            if (channel.modulus < 0) return 0;
+        } else {
+            legacyChannelParams(channel);
+        }
+    }
+
+    // Fitted models (v7+)
+    info.modelCount = 0;
+    if (info.version >= 7) {
+        const uint8_t* p = buf + REPLAY_FILE_HEADER_SIZE + info.channelCount * entrySize;
+        if (p[0] > REPLAY_MAX_MODELS) return 0;
+        info.modelCount = p[0];
+        for (uint8_t i = 0; i < info.modelCount; i++) {
+            const uint8_t* entry = p + 1 + i * REPLAY_MODEL_ENTRY_SIZE;
+            info.models[i].channel = entry[0];
+            info.models[i].kS = getLEFloat(entry + 1);
+            info.models[i].kV = getLEFloat(entry + 5);
+            info.models[i].kA = getLEFloat(entry + 9);
+        }
+    }
+    return headerSize;
+}
+
+// Read and validate the header from a file. The magic has already been consumed by the caller.
+static bool readRecordingHeader(FILE* file, RecordingInfo& info) {
+    uint8_t buf[REPLAY_FILE_HEADER_SIZE + REPLAY_MAX_CHANNELS * REPLAY_CHANNEL_ENTRY_SIZE +
+                1 + REPLAY_MAX_MODELS * REPLAY_MODEL_ENTRY_SIZE + 4];
+    buf[0] = REPLAY_MAGIC & 0xFF;
+    buf[1] = (REPLAY_MAGIC >> 8) & 0xFF;
+    buf[2] = (REPLAY_MAGIC >> 16) & 0xFF;
+    buf[3] = (REPLAY_MAGIC >> 24) & 0xFF;
+
+    if (fread(buf + 4, 1, REPLAY_FILE_HEADER_SIZE - 4, file) != REPLAY_FILE_HEADER_SIZE - 4) {
+        return false;
+    }
+
+    // Size field is checked properly by parseRecordingHeader - just don't overrun buf
+    uint16_t headerSize = getLE16(buf + 6);
+    if (headerSize < REPLAY_FILE_HEADER_SIZE || headerSize > sizeof(buf)) return false;
+
+    size_t rest = headerSize - REPLAY_FILE_HEADER_SIZE;
+    if (fread(buf + REPLAY_FILE_HEADER_SIZE, 1, rest, file) != rest) return false;
+
+    return parseRecordingHeader(buf, headerSize, info) != 0;
+}
+
+// --------------------- Varints ---------------------
+
+static uint32_t zigzag(int32_t v) {
+    return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+    return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+}
+
+static void putVarint(ByteBuffer& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+// Returns false if the varint runs past end or is longer than 5 bytes
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (p >= end) return false;
+        uint8_t byte = *p++;
+        v |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// --------------------- Blocks ---------------------
+
+static void encodePackedPayload(const RecordingInfo& info, const ColumnBlock& block,
+                                uint16_t first, uint16_t count, ByteBuffer& out) {
+    for (uint16_t f = first; f < first + count; f++) {
+        for (uint8_t c = 0; c < info.channelCount; c++) {
+            putValue(out, info.channels[c].type, block.value(c, f));
+        }
+    }
+}
+
+// Append the run-length delta tokens for one frame of one channel, if its run has ended.
+// prevValue/prevDelta/run are that channel's encoder state.
+static void encodeDeltaToken(const ColumnBlock& block, uint8_t c, const ChannelEntry& channel, uint16_t first,
+                             uint16_t count, uint16_t f, int32_t& prevValue, int32_t& prevDelta,
+                             uint32_t& run, ByteBuffer& out) {
+    int32_t modulus = channel.modulus;
+    int32_t value = block.value(c, f);
+    int32_t delta = (f == first) ? 0 : wrapDelta(value - prevValue, modulus);
+
+    if (run > 0) {
+        // Inside a run the step repeats by construction
+        run--;
+    } else {
+        int32_t token;
+        if (f == first) token = value;
+        else if (channel.secondOrder) token = delta - prevDelta;
+        else token = delta;
+        putVarint(out, zigzag(token));
+
+        // Count how many following frames repeat this step
+        uint32_t length = 0;
+        int32_t last = value;
+        for (uint16_t g = f + 1; g < first + count; g++) {
+            int32_t next = block.value(c, g);
+            int32_t step = wrapDelta(next - last, modulus);
+            int32_t expected = channel.secondOrder ? delta : 0;
+            if (step != expected) break;
+            last = next;
+            length++;
+        }
+        putVarint(out, length);
+        run = length;
+    }
+
+    prevValue = value;
+    prevDelta = delta;
+}
+
+// Tokens interleaved frame by frame (v2)
+static void encodeDeltaPayload(const RecordingInfo& info, const ColumnBlock& block,
+                               uint16_t first, uint16_t count, ByteBuffer& out) {
+    int32_t prevValue[REPLAY_MAX_CHANNELS] = {};
+    int32_t prevDelta[REPLAY_MAX_CHANNELS] = {};
+    uint32_t run[REPLAY_MAX_CHANNELS] = {};
+
+    for (uint16_t f = first; f < first + count; f++) {
+        for (uint8_t c = 0; c < info.channelCount; c++) {
+            encodeDeltaToken(block, c, info.channels[c], first, count, f,
+                             prevValue[c], prevDelta[c], run[c], out);
+        }
+    }
+}
+
+// The same tokens, one channel at a time with a length prefix per column
+static void encodeColumnarPayload(const RecordingInfo& info, const ColumnBlock& block,
+                                  uint16_t first, uint16_t count, ByteBuffer& out) {
+    for (uint8_t c = 0; c < info.channelCount; c++) {
+        int32_t prevValue = 0;
+        int32_t prevDelta = 0;
+        uint32_t run = 0;
+
+        // Encode the column in place, then slide it up to make room for its length
+        size_t start = out.size();
+        for (uint16_t f = first; f < first + count; f++) {
+            encodeDeltaToken(block, c, info.channels[c], first, count, f,
+                             prevValue, prevDelta, run, out);
+        }
+        if (out.overflowed()) return;
+
+        size_t length = out.size() - start;
+        uint8_t prefix[5];
+        uint8_t prefixSize = 0;
+        for (size_t v = length; ; v >>= 7) {
+            prefix[prefixSize++] = (v >= 0x80) ? ((v & 0x7F) | 0x80) : v;
+            if (v < 0x80) break;
+        }
+
+        if (!out.resize(out.size() + prefixSize)) return;
+        memmove(out.data() + start + prefixSize, out.data() + start, length);
+        memcpy(out.data() + start, prefix, prefixSize);
+    }
+}
+
+static bool encodeRange(const RecordingInfo& info, const ColumnBlock& block, uint16_t first,
+                        uint16_t count, ByteBuffer& out, uint8_t encoding) {
+    size_t headerPos = out.size();
+    if (!out.resize(headerPos + REPLAY_BLOCK_HEADER_SIZE)) {  // Filled in once the payload is known
+        out.truncate(headerPos);
+        return false;
+    }
+    size_t payloadPos = out.size();
+    size_t packedSize = packedFrameSize(info) * count;
+
+    if (encoding == ENC_DELTA) {
+        encodeDeltaPayload(info, block, first, count, out);
+    } else if (encoding == ENC_COLUMNAR) {
+        encodeColumnarPayload(info, block, first, count, out);
+    }
+
+    // Noisy data can make deltas bigger than the plain values - store those
+    // packed, which also caps every block at a known worst-case size
+    if (encoding == ENC_PACKED || out.overflowed() || out.size() - payloadPos > packedSize) {
+        encoding = ENC_PACKED;
+        out.truncate(payloadPos);
+        encodePackedPayload(info, block, first, count, out);
+    }
+
+    // Keep every block small enough for the streaming reader's fixed slots
+    if (out.size() - payloadPos > REPLAY_MAX_BLOCK_PAYLOAD && count > 1) {
+        out.truncate(headerPos);
+        if (!encodeRange(info, block, first, count / 2, out, encoding) ||
+            !encodeRange(info, block, first + count / 2, count - count / 2, out, encoding)) {
+            out.truncate(headerPos);
+            return false;
+        }
+        return true;
+    }
+
+    if (out.overflowed()) {
+        out.truncate(headerPos);
+        return false;
+    }
+
+    uint32_t payloadSize = out.size() - payloadPos;
+    uint32_t crc = replayCrc32(out.data() + payloadPos, payloadSize);
+
+    uint8_t* h = out.data() + headerPos;
+    h[0] = count & 0xFF;
+    h[1] = (count >> 8) & 0xFF;
+    h[2] = encoding;
+    h[3] = 0;
+    for (int i = 0; i < 4; i++) h[4 + i] = (payloadSize >> (8 * i)) & 0xFF;
+    for (int i = 0; i < 4; i++) h[8 + i] = (crc >> (8 * i)) & 0xFF;
+    return true;
+}
+
+bool encodeBlock(const RecordingInfo& info, const ColumnBlock& block,
+                 ByteBuffer& out, uint8_t encoding) {
+    return block.size() == 0 || encodeRange(info, block, 0, block.size(), out, encoding);
+}
+
+size_t guaranteedBlocksSize(const RecordingInfo& info) {
+    return worstCaseBlocksSize(info, REPLAY_GUARANTEED_MS / info.samplePeriodMs);
+}
+
+size_t worstCaseBlocksSize(const RecordingInfo& info, uint32_t frames) {
+    // Every block is at most packed size, and splitting for the payload limit
+    // never leaves fewer than half as many frames per block as would fit
+    size_t frameSize = packedFrameSize(info);
+    if (frameSize == 0) return 0;
+
+    size_t fit = REPLAY_MAX_BLOCK_PAYLOAD / frameSize;
+    if (fit > info.framesPerBlock) fit = info.framesPerBlock;
+    size_t minPerBlock = fit / 2 > 0 ? fit / 2 : 1;
+
+    // Plus one short block for every flush (block boundary or checkpoint)
+    size_t blocks = frames / minPerBlock + frames / info.framesPerBlock + 2;
+    return frames * frameSize + blocks * REPLAY_BLOCK_HEADER_SIZE;
+}
+
+bool checkBlockHeader(const RecordingInfo& info, const uint8_t* header) {
+    uint16_t count = getLE16(header);
+    uint8_t encoding = header[2];
+    uint32_t payloadSize = getLE32(header + 4);
+
+    if (count == 0 || count > info.framesPerBlock) return false;
+    if (encoding != ENC_PACKED && encoding != ENC_DELTA && encoding != ENC_COLUMNAR) return false;
+    if (encoding == ENC_PACKED && payloadSize != packedFrameSize(info) * count) return false;
+    return payloadSize <= REPLAY_MAX_BLOCK_PAYLOAD;
+}
+
+// Walk a buffer of blocks checking structure and CRCs. Returns the total frame count via frames.
+static bool validateBlocks(const RecordingInfo& info, const uint8_t* data, size_t size, uint32_t& frames) {
+    frames = 0;
+    size_t offset = 0;
+    while (offset < size) {
+        if (size - offset < REPLAY_BLOCK_HEADER_SIZE) return false;  // Truncated header
+
+        const uint8_t* h = data + offset;
+        uint16_t count = getLE16(h);
+        uint32_t payloadSize = getLE32(h + 4);
+        uint32_t crc = getLE32(h + 8);
+
+        if (!checkBlockHeader(info, h)) return false;
+        if (payloadSize > size - offset - REPLAY_BLOCK_HEADER_SIZE) return false;  // Truncated payload
+        if (replayCrc32(h + REPLAY_BLOCK_HEADER_SIZE, payloadSize) != crc) return false;
+
+        frames += count;
+        offset += REPLAY_BLOCK_HEADER_SIZE + payloadSize;
+    }
+    return true;
+}
+
+// --------------------- EncodedRecording ---------------------
+
+void EncodedRecording::clear() {
+    initRecordingInfo(info);
+    blocks.clear();
+}
+
+// --------------------- RecordingEncoder ---------------------
+
+bool RecordingEncoder::prepare() {
+    RecordingInfo info;
+    initRecordingInfo(info);
+    return pending.init(info, info.framesPerBlock);
+}
+
+bool RecordingEncoder::begin(EncodedRecording& recording, uint8_t flags, uint16_t batteryMv) {
+    target = &recording;
+    target->clear();
+    target->info.flags |= flags;
+    target->info.batteryMv = batteryMv;
+    encodedDurationMs = 0;
+    return pending.init(target->info, target->info.framesPerBlock);
+}
+
+bool RecordingEncoder::flushPending() {
+    if (!target || pending.size() == 0) return true;
+    if (!encodeBlock(target->info, pending, target->blocks)) return false;
+    encodedDurationMs = target->info.durationMs;
+    pending.clear();
+    return true;
+}
+
+bool RecordingEncoder::addFrame(const RecordedFrame& frame) {
+    if (!target) return false;
+    if (pending.full() && !flushPending()) return false;
+    if (!pending.push(frame)) return false;
+
+    target->info.frameCount++;
+    target->info.durationMs = frame.timestamp / 1000;
+    return true;
+}
+
+bool RecordingEncoder::finish() {
+    if (flushPending()) return true;
+
+    // Couldn't store the last block - drop it so the header still matches the blocks
+    target->info.frameCount -= pending.size();
+    target->info.durationMs = encodedDurationMs;
+    pending.clear();
+    return false;
+}
+
+// --------------------- RecordingReader ---------------------
+
+RecordingReader::RecordingReader(const RecordingInfo& info, const uint8_t* data, size_t size)
+    : info(&info), data(data), size(size) {}
+
+void RecordingReader::rewind() {
+    offset = 0;
+    blockFrames = 0;
+    frameInBlock = 0;
+}
+
+bool RecordingReader::openNextBlock() {
+    if (size - offset < REPLAY_BLOCK_HEADER_SIZE) return false;
+
+    const uint8_t* h = data + offset;
+    blockFrames = getLE16(h);
+    encoding = h[2];
+    uint32_t payloadSize = getLE32(h + 4);
+    if (blockFrames == 0 || payloadSize > size - offset - REPLAY_BLOCK_HEADER_SIZE) return false;
+
+    cursor = h + REPLAY_BLOCK_HEADER_SIZE;
+    blockEnd = cursor + payloadSize;
+    offset += REPLAY_BLOCK_HEADER_SIZE + payloadSize;
+    frameInBlock = 0;
+
+    // Find where each column starts
+    if (encoding == ENC_COLUMNAR) {
+        const uint8_t* p = cursor;
+        for (uint8_t c = 0; c < info->channelCount; c++) {
+            uint32_t length;
+            if (!getVarint(p, blockEnd, length) || length > static_cast<size_t>(blockEnd - p)) return false;
+            columnCursor[c] = p;
+            columnEnd[c] = p + length;
+            p += length;
+        }
+    }
+
+    // Every block starts from absolute values
+    for (uint8_t c = 0; c < info->channelCount; c++) {
+        values[c] = 0;
+        deltas[c] = 0;
+        runs[c] = 0;
+    }
+    return true;
+}
+
+bool RecordingReader::next(RecordedFrame& frame) {
+    if (frameInBlock >= blockFrames && !openNextBlock()) return false;
+
+    frame = RecordedFrame();
+    for (uint8_t c = 0; c < info->channelCount; c++) {
+        const ChannelEntry& channel = info->channels[c];
+        uint8_t id = channel.id;
+        uint8_t type = channel.type;
+
+        if (encoding == ENC_PACKED) {
+            size_t width = channelTypeSize(type);
+            if (static_cast<size_t>(blockEnd - cursor) < width) return false;
+            values[c] = getValue(cursor, type);
+            cursor += width;
+        } else {
+            // Delta tokens come from the shared stream, or the channel's own column
+            const uint8_t*& p = (encoding == ENC_COLUMNAR) ? columnCursor[c] : cursor;
+            const uint8_t* end = (encoding == ENC_COLUMNAR) ? columnEnd[c] : blockEnd;
+
+            int32_t delta;
+            if (runs[c] > 0) {
+                runs[c]--;
+                delta = channel.secondOrder ? deltas[c] : 0;
+            } else {
+                uint32_t token, length;
+                if (!getVarint(p, end, token) || !getVarint(p, end, length)) {
+                    return false;
+                }
+                if (length >= static_cast<uint32_t>(blockFrames - frameInBlock)) return false;
+                runs[c] = length;
+
+                if (frameInBlock == 0) {
+                    values[c] = unzigzag(token);
+                    delta = 0;
+                } else {
+                    delta = channel.secondOrder ? deltas[c] + unzigzag(token) : unzigzag(token);
+                }
+            }
+            if (frameInBlock > 0) {
+                values[c] = wrapValue(values[c] + delta, channel.modulus);
+            }
+            deltas[c] = delta;
+        }
+        setChannelValue(frame, id, values[c]);
+    }
+
+    frameInBlock++;
+    return true;
+}
+
+// --------------------- Whole-file I/O ---------------------
+
+bool writeRecording(FILE* file, const EncodedRecording& recording) {
+    std::vector<uint8_t> header;
+    writeRecordingHeader(recording.info, header);
+    if (fwrite(header.data(), 1, header.size(), file) != header.size()) return false;
+
+    // Blocks are already encoded - one write for the whole recording
+    size_t size = recording.blocks.size();
+    return size == 0 || fwrite(recording.blocks.data(), 1, size, file) == size;
+}
+
+bool updateRecordingHeader(const char* path, const RecordingInfo& info) {
+    FILE* file = fopen(path, "r+b");
+    if (!file) return false;
+
+    // Only in place: the blocks must not move
+    RecordingInfo old;
+    bool ok = readRecordingInfo(file, old) &&
+              headerSizeFor(old.version, old.channelCount) == headerSizeFor(REPLAY_VERSION, info.channelCount);
+
+    if (ok) {
+        std::vector<uint8_t> header;
+        writeRecordingHeader(info, header);
+        ok = fseek(file, 0, SEEK_SET) == 0 && fwrite(header.data(), 1, header.size(), file) == header.size();
+    }
+    fclose(file);
+    return ok;
+}
+
+// Layout of the original raw format (uint64_t timestamp forces 8-byte alignment -> 24 bytes)
+struct LegacyFrame {
+    uint64_t timestamp;
+    int8_t leftStick;
+    int8_t rightStick;
+    int8_t intakePower;
+    int8_t outtakePower;
+    float heading;
+    uint8_t buttons;
+};
+static_assert(sizeof(LegacyFrame) == 24, "Legacy recording layout changed");
+
+// Legacy files were capped at 15000 frames; anything larger is not a legacy file
+constexpr uint32_t LEGACY_MAX_FRAMES = 15000;
+
+// Give a recording that has no buffer yet room for the guaranteed length. One
+// that already has a buffer keeps it - a file that doesn't fit is refused
+// rather than carving a second region from the arena.
+static bool reserveRecording(EncodedRecording& recording) {
+    if (recording.blocks.capacity() > 0) return true;
+
+    RecordingInfo info;
+    initRecordingInfo(info);
+    return recording.blocks.reserve(guaranteedBlocksSize(info));
+}
+
+// Legacy frames are re-encoded into blocks while reading, so the result matches a native load
+static RecordingEncoder legacyEncoder;
+static bool legacyEncoderReady = false;
+
+bool prepareLegacyRead() {
+    legacyEncoderReady = legacyEncoder.prepare();
+    return legacyEncoderReady;
+}
+
+static bool readLegacyRecording(FILE* file, uint32_t frameCount, EncodedRecording& recording) {
+    if (frameCount > LEGACY_MAX_FRAMES || !legacyEncoderReady) return false;
+
+    // No checksums in the old format - at least make sure every frame is there
+    // before the current recording is given up for it
+    long start = ftell(file);
+    if (start < 0 || fseek(file, 0, SEEK_END) != 0) return false;
+    long end = ftell(file);
+    if (end - start < static_cast<long>(frameCount * sizeof(LegacyFrame))) return false;
+    if (fseek(file, start, SEEK_SET) != 0) return false;
+
+    if (!reserveRecording(recording)) return false;
+    if (!legacyEncoder.begin(recording)) return false;
+
+    LegacyFrame chunk[64];
+    for (uint32_t first = 0; first < frameCount; first += 64) {
+        uint32_t count = frameCount - first;
+        if (count > 64) count = 64;
+        if (fread(chunk, sizeof(LegacyFrame), count, file) != count) {
+            recording.clear();
+            return false;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            RecordedFrame frame;
+            frame.timestamp = static_cast<uint32_t>(chunk[i].timestamp);
+            frame.set(CH_LEFT_STICK, chunk[i].leftStick);
+            frame.set(CH_RIGHT_STICK, chunk[i].rightStick);
+            frame.set(CH_INTAKE, chunk[i].intakePower);
+            frame.set(CH_OUTTAKE, chunk[i].outtakePower);
+            frame.set(CH_HEADING, replayChannels.toRaw(CH_HEADING, chunk[i].heading));
+            frame.set(CH_BUTTONS, chunk[i].buttons);
+            if (!legacyEncoder.addFrame(frame)) {
+                recording.clear();
+                return false;
+            }
+        }
+    }
+    if (legacyEncoder.finish()) return true;
+    recording.clear();
+    return false;
+}
+
+bool readRecordingInfo(FILE* file, RecordingInfo& info, bool allowUnfinished) {
+    uint8_t magicBytes[4];
+    if (fread(magicBytes, 1, 4, file) != 4) return false;
+    if (getLE32(magicBytes) != REPLAY_MAGIC) return false;
+
+    if (!readRecordingHeader(file, info)) return false;
+    return allowUnfinished || !(info.flags & REPLAY_FLAG_STREAMING);  // Recording was never finished
+}
+
+// validateBlocks() for blocks still in a file, from the current position to
+// the end, CRC'd through a small scratch buffer so nothing has to be loaded
+static bool validateFileBlocks(FILE* file, const RecordingInfo& info, size_t size, uint32_t& frames) {
+    uint8_t scratch[256];
+    frames = 0;
+    size_t offset = 0;
+    while (offset < size) {
+        if (size - offset < REPLAY_BLOCK_HEADER_SIZE) return false;  // Truncated header
+
+        uint8_t h[REPLAY_BLOCK_HEADER_SIZE];
+        if (fread(h, 1, sizeof(h), file) != sizeof(h)) return false;
+        uint16_t count = getLE16(h);
+        uint32_t payloadSize = getLE32(h + 4);
+        uint32_t crc = getLE32(h + 8);
+
+        if (!checkBlockHeader(info, h)) return false;
+        if (payloadSize > size - offset - REPLAY_BLOCK_HEADER_SIZE) return false;  // Truncated payload
+
+        uint32_t actual = 0;
+        for (uint32_t done = 0; done < payloadSize;) {
+            size_t chunk = payloadSize - done < sizeof(scratch) ? payloadSize - done : sizeof(scratch);
+            if (fread(scratch, 1, chunk, file) != chunk) return false;
+            actual = replayCrc32(scratch, chunk, actual);
+            done += chunk;
+        }
+        if (actual != crc) return false;
+
+        frames += count;
+        offset += REPLAY_BLOCK_HEADER_SIZE + payloadSize;
+    }
+    return true;
+}
+
+bool readRecording(FILE* file, EncodedRecording& recording) {
+    uint8_t magicBytes[4];
+    if (fread(magicBytes, 1, 4, file) != 4) return false;
+
+    uint32_t magic = getLE32(magicBytes);
+    if (magic != REPLAY_MAGIC) {
+        // Old files start with a bare frame count instead of the magic
+        return readLegacyRecording(file, magic, recording);
+    }
+
+    RecordingInfo info;
+    if (!readRecordingHeader(file, info)) return false;
+    if (info.flags & REPLAY_FLAG_STREAMING) return false;  // Recording was never finished
+
+    long start = ftell(file);
+    if (start < 0 || fseek(file, 0, SEEK_END) != 0) return false;
+    long end = ftell(file);
+    if (end < start || fseek(file, start, SEEK_SET) != 0) return false;
+    size_t size = end - start;
+
+    // Check every block's CRC and the frame count in the file first - the
+    // current recording is only given up for one that is known to be good
+    uint32_t frames = 0;
+    if (!validateFileBlocks(file, info, size, frames)) return false;
+    if (frames != info.frameCount) return false;
+
+    ByteBuffer& blocks = recording.blocks;
+    if (!reserveRecording(recording) || size > blocks.capacity()) return false;
+    if (fseek(file, start, SEEK_SET) != 0) return false;
+
+    // Pull all blocks in with a single read. Only an SD error between the two
+    // passes can fail now, and that leaves no recording rather than half of one.
+    if (!blocks.resize(size) || (size > 0 && fread(blocks.data(), 1, size, file) != size) ||
+        !validateBlocks(info, blocks.data(), size, frames)) {
+        recording.clear();
+        return false;
+    }
+
+    recording.info = info;
+    return true;
+}
+
+bool openRecordingBuffer(const uint8_t* data, size_t size, RecordingInfo& info,
+                         const uint8_t*& blocks, size_t& blocksSize) {
+    RecordingInfo parsed;
+    size_t headerSize = parseRecordingHeader(data, size, parsed);
+    if (headerSize == 0) return false;
+    if (parsed.flags & REPLAY_FLAG_STREAMING) return false;  // Recording was never finished
+
+    uint32_t frames = 0;
+    if (!validateBlocks(parsed, data + headerSize, size - headerSize, frames)) return false;
+    if (frames != parsed.frameCount) return false;
+
+    info = parsed;
+    blocks = data + headerSize;
+    blocksSize = size - headerSize;
+    return true;
+}
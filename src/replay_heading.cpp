@@ -0,0 +1,122 @@
+#include "replay_heading.h"
+#include "robot_config.h"
+#include <cmath>
+#include <mutex>
+
+void HeadingController::start(DriveOutput mode, float maxRpm, float startHeading) {
+    stop();
+
+    output = mode;
+    this->maxRpm = maxRpm;
+    pid.reset();
+    startRotation = static_cast<float>(imu.get_rotation()) - startHeading;
+    targetHeading = startHeading;
+    baseLeft = 0.0f;
+    baseRight = 0.0f;
+    posted = false;
+    maxError = 0.0f;
+    launch();
+}
+
+void HeadingController::resume() {
+    if (taskRunning) return;
+
+    pid.reset();
+    {
+        std::lock_guard<pros::Mutex> guard(commandLock);
+        posted = false;
+    }
+    launch();
+}
+
+void HeadingController::launch() {
+    // Same priority as playback, so it isn't starved by the loop it serves
+    stopRequested = false;
+    taskRunning = true;
+    pros::Task controller([this] { controlTask(); }, TASK_PRIORITY_MAX - 1, TASK_STACK_DEPTH_DEFAULT,
+                          "replay heading");
+}
+
+void HeadingController::post(float compassHeading, float left, float right) {
+    std::lock_guard<pros::Mutex> guard(commandLock);
+
+    // Recorded headings are compass angles - unwrap against the last target so
+    // a recording that turns past 360 keeps counting, like get_rotation() does
+    targetHeading = unwrapDegrees(compassHeading, targetHeading);
+    baseLeft = left;
+    baseRight = right;
+    posted = true;
+}
+
+void HeadingController::stop() {
+    stopRequested = true;
+    while (taskRunning) {
+        pros::delay(1);
+    }
+}
+
+void HeadingController::drive(float left, float right) {
+    if (left > 127) left = 127;
+    if (left < -127) left = -127;
+    if (right > 127) right = 127;
+    if (right < -127) right = -127;
+
+    switch (output) {
+    case DriveOutput::VELOCITY:
+        left_motors.move_velocity(static_cast<int32_t>(std::lround(left * maxRpm / 127.0f)));
+        right_motors.move_velocity(static_cast<int32_t>(std::lround(right * maxRpm / 127.0f)));
+        break;
+    case DriveOutput::VOLTAGE:
+        left_motors.move_voltage(static_cast<int32_t>(std::lround(left * 12000.0f / 127.0f)));
+        right_motors.move_voltage(static_cast<int32_t>(std::lround(right * 12000.0f / 127.0f)));
+        break;
+    default:
+        left_motors.move(static_cast<int32_t>(std::lround(left)));
+        right_motors.move(static_cast<int32_t>(std::lround(right)));
+        break;
+    }
+}
+
+void HeadingController::controlTask() {
+    uint32_t wakeTime = pros::millis();
+    float lastRotation = 0.0f;
+    bool haveLast = false;
+    const float dt = REPLAY_HEADING_PERIOD_MS / 1000.0f;
+
+    while (!stopRequested) {
+        float target, left, right;
+        bool ready;
+        {
+            std::lock_guard<pros::Mutex> guard(commandLock);
+            target = targetHeading;
+            left = baseLeft;
+            right = baseRight;
+            ready = posted;
+        }
+
+        float rotation = static_cast<float>(imu.get_rotation()) - startRotation;
+
+        // Gyro z is counter-clockwise positive, rotation clockwise positive.
+        // Fall back to differencing the rotation if the rate read fails.
+        double gyroZ = imu.get_gyro_rate().z;
+        float rate = -static_cast<float>(gyroZ);
+        if (gyroZ == PROS_ERR_F || !std::isfinite(rate)) {
+            rate = haveLast ? (rotation - lastRotation) / dt : 0.0f;
+        }
+        lastRotation = rotation;
+        haveLast = true;
+
+        if (ready && std::isfinite(rotation)) {
+            float error = target - rotation;
+            if (std::fabs(error) > maxError) maxError = std::fabs(error);
+
+            float correction = pid.compute(error, rate, (left + right) / 2, dt);
+
+            // Apply correction (positive error = robot is too far right, need to turn left)
+            drive(left - correction, right + correction);
+        }
+
+        pros::Task::delay_until(&wakeTime, REPLAY_HEADING_PERIOD_MS);
+    }
+    taskRunning = false;
+}
@@ -0,0 +1,150 @@
+#include "replay_latency.h"
+#include <cstdio>
+
+// Latency file layout (little-endian):
+//   uint32_t magic "ARLT", uint16_t version, uint16_t count
+//   count x uint16_t milliseconds (LatencyActuator order)
+//   uint32_t CRC32 of everything above
+constexpr uint32_t LATENCY_MAGIC = 0x544C5241;  // "ARLT" when read as bytes
+constexpr uint16_t LATENCY_VERSION = 1;
+
+bool loadLatencyTable(const char* path, LatencyTable& table) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+
+    uint8_t buf[8 + LAT_COUNT * 2 + 4];
+    size_t got = fread(buf, 1, sizeof(buf), file);
+    fclose(file);
+
+    if (got != sizeof(buf)) return false;
+    if (getLE32(buf) != LATENCY_MAGIC || getLE16(buf + 4) != LATENCY_VERSION) return false;
+    if (getLE16(buf + 6) != LAT_COUNT) return false;
+    if (replayCrc32(buf, sizeof(buf) - 4) != getLE32(buf + sizeof(buf) - 4)) return false;
+
+    for (int i = 0; i < LAT_COUNT; i++) {
+        table.ms[i] = getLE16(buf + 8 + i * 2);
+    }
+    return true;
+}
+
+bool saveLatencyTable(const char* path, const LatencyTable& table) {
+    uint8_t buf[8 + LAT_COUNT * 2 + 4];
+
+    putLE32(buf, LATENCY_MAGIC);
+    putLE16(buf + 4, LATENCY_VERSION);
+    putLE16(buf + 6, LAT_COUNT);
+    for (int i = 0; i < LAT_COUNT; i++) {
+        putLE16(buf + 8 + i * 2, table.ms[i]);
+    }
+    putLE32(buf + sizeof(buf) - 4, replayCrc32(buf, sizeof(buf) - 4));
+
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    bool ok = fwrite(buf, 1, sizeof(buf), file) == sizeof(buf);
+    fclose(file);
+    return ok;
+}
+
+void LeadSource::attach(FrameSource& frames) {
+    source = &frames;
+    laneCount = 0;
+    windowStart = 0;
+    windowCount = 0;
+    exhausted = false;
+    basePos = 0;
+    time = 0;
+    started = false;
+}
+
+bool LeadSource::addLane(uint8_t channel, int32_t mask, uint32_t leadUs) {
+    if (leadUs == 0) return true;
+    if (laneCount >= REPLAY_MAX_LEAD_LANES || channel >= REPLAY_MAX_CHANNELS) return false;
+    lanes[laneCount++] = {channel, mask, leadUs, 0};
+    return true;
+}
+
+bool LeadSource::sameValue(const Lane& lane, uint32_t a, uint32_t b) const {
+    return (at(a).get(lane.channel) & lane.mask) == (at(b).get(lane.channel) & lane.mask);
+}
+
+void LeadSource::fill() {
+    while (windowCount < REPLAY_LEAD_WINDOW && !exhausted) {
+        if (source->next(window[(windowStart + windowCount) % REPLAY_LEAD_WINDOW])) {
+            windowCount++;
+        } else {
+            exhausted = true;
+        }
+    }
+}
+
+void LeadSource::advance() {
+    // Every reader moves to the last frame due by now. Lanes also skip frames
+    // that don't change them, so the next one they stop at is a real change.
+    uint32_t end = windowStart + windowCount;
+    while (basePos + 1 < end && at(basePos + 1).timestamp <= time) basePos++;
+
+    for (uint8_t i = 0; i < laneCount; i++) {
+        Lane& lane = lanes[i];
+        if (lane.pos < basePos) lane.pos = basePos;
+        while (lane.pos + 1 < end &&
+               (at(lane.pos + 1).timestamp <= time + lane.leadUs || sameValue(lane, lane.pos, lane.pos + 1))) {
+            lane.pos++;
+        }
+    }
+}
+
+bool LeadSource::next(RecordedFrame& frame) {
+    if (!source) return false;
+
+    if (!started) {
+        fill();
+        if (windowCount == 0) return false;
+        started = true;
+        time = at(windowStart).timestamp;
+        basePos = windowStart;
+        for (uint8_t i = 0; i < laneCount; i++) lanes[i].pos = windowStart;
+        advance();
+    } else {
+        // Free what nothing reads any more, read further ahead, and let any
+        // lane that was waiting on the window catch up
+        while (windowStart < basePos) {
+            windowStart++;
+            windowCount--;
+        }
+        fill();
+        advance();
+
+        // Next frame: whichever comes first of the next source frame and each lane's next change
+        uint32_t end = windowStart + windowCount;
+        bool haveNext = false;
+        uint32_t nextTime = 0;
+        if (basePos + 1 < end) {
+            nextTime = at(basePos + 1).timestamp;
+            haveNext = true;
+        }
+        for (uint8_t i = 0; i < laneCount; i++) {
+            if (lanes[i].pos + 1 >= end) continue;
+            uint32_t change = at(lanes[i].pos + 1).timestamp - lanes[i].leadUs;
+            // Never before a frame already handed out: timestamps must not go
+            // backwards, or CommandStream::compile underflows
+            if (change < time) change = time;
+            if (!haveNext || change < nextTime) {
+                nextTime = change;
+                haveNext = true;
+            }
+        }
+        if (!haveNext) return false;
+
+        time = nextTime;
+        advance();
+    }
+
+    frame = at(basePos);
+    frame.timestamp = time;
+    for (uint8_t i = 0; i < laneCount; i++) {
+        const Lane& lane = lanes[i];
+        int32_t value = at(lane.pos).get(lane.channel);
+        frame.set(lane.channel, (frame.get(lane.channel) & ~lane.mask) | (value & lane.mask));
+    }
+    return true;
+}
@@ -0,0 +1,177 @@
+#include "replay_library.h"
+#include "replay_format.h"
+#include "replay_stream.h"
+#include <cstdio>
+
+// Global instance
+ReplayLibrary replayLibrary;
+
+// Index file layout (little-endian):
+//   uint32_t magic "ARIX", uint16_t version, uint16_t slotCount
+//   slotCount x { frameCount, durationMs, fileSize, checksum } (uint32_t each)
+//   uint32_t CRC32 of everything above
+constexpr uint32_t INDEX_MAGIC = 0x58495241;  // "ARIX" when read as bytes
+constexpr uint16_t INDEX_VERSION = 1;
+constexpr size_t INDEX_ENTRY_SIZE = 16;
+static const char* INDEX_PATH = "/usd/replay_index.bin";
+
+static const char* slotNames[REPLAY_SLOT_COUNT] = {
+    "SKILLS",
+    "LEFT",
+    "RIGHT",
+    "R-DESCORE",
+    "EXTRA 1",
+    "EXTRA 2",
+    "EXTRA 3",
+    "EXTRA 4"
+};
+
+// Slot 0 keeps the original file name so existing recordings become the SKILLS slot
+static const char* slotPaths[REPLAY_SLOT_COUNT] = {
+    "/usd/auton_recording.bin",
+    "/usd/replay_slot1.bin",
+    "/usd/replay_slot2.bin",
+    "/usd/replay_slot3.bin",
+    "/usd/replay_slot4.bin",
+    "/usd/replay_slot5.bin",
+    "/usd/replay_slot6.bin",
+    "/usd/replay_slot7.bin"
+};
+
+const char* ReplayLibrary::getSlotName(int slot) {
+    return isValidSlot(slot) ? slotNames[slot] : "?";
+}
+
+const char* ReplayLibrary::getSlotPath(int slot) {
+    return isValidSlot(slot) ? slotPaths[slot] : slotPaths[0];
+}
+
+int ReplayLibrary::init() {
+    // Salvage recordings that were cut off by a brownout or program stop:
+    // first a previous recording a commit had moved aside, then any part file.
+    // A committed recording leaves neither behind, so this is normally a no-op.
+    int recovered = 0;
+    for (int i = 0; i < REPLAY_SLOT_COUNT; i++) {
+        if (restoreBackup(slotPaths[i])) recovered++;
+
+        std::string partPath = replayPartPath(slotPaths[i]);
+        if (recoverRecording(partPath.c_str(), slotPaths[i])) {
+            discardPartFile(partPath.c_str());
+            recovered++;
+        }
+    }
+
+    if (!loadIndex() || recovered > 0) {
+        rebuildIndex();
+        saveIndex();
+    }
+    return recovered;
+}
+
+bool ReplayLibrary::loadIndex() {
+    FILE* file = fopen(INDEX_PATH, "rb");
+    if (!file) return false;
+
+    uint8_t buf[8 + REPLAY_SLOT_COUNT * INDEX_ENTRY_SIZE + 4];
+    size_t got = fread(buf, 1, sizeof(buf), file);
+    fclose(file);
+
+    if (got != sizeof(buf)) return false;
+    if (getLE32(buf) != INDEX_MAGIC || getLE16(buf + 4) != INDEX_VERSION) return false;
+    if (getLE16(buf + 6) != REPLAY_SLOT_COUNT) return false;
+    if (replayCrc32(buf, sizeof(buf) - 4) != getLE32(buf + sizeof(buf) - 4)) return false;
+
+    for (int i = 0; i < REPLAY_SLOT_COUNT; i++) {
+        const uint8_t* p = buf + 8 + i * INDEX_ENTRY_SIZE;
+        entries[i].frameCount = getLE32(p);
+        entries[i].durationMs = getLE32(p + 4);
+        entries[i].fileSize = getLE32(p + 8);
+        entries[i].checksum = getLE32(p + 12);
+    }
+    return true;
+}
+
+bool ReplayLibrary::saveIndex() {
+    uint8_t buf[8 + REPLAY_SLOT_COUNT * INDEX_ENTRY_SIZE + 4];
+
+    putLE32(buf, INDEX_MAGIC);
+    putLE16(buf + 4, INDEX_VERSION);
+    putLE16(buf + 6, REPLAY_SLOT_COUNT);
+    for (int i = 0; i < REPLAY_SLOT_COUNT; i++) {
+        uint8_t* p = buf + 8 + i * INDEX_ENTRY_SIZE;
+        putLE32(p, entries[i].frameCount);
+        putLE32(p + 4, entries[i].durationMs);
+        putLE32(p + 8, entries[i].fileSize);
+        putLE32(p + 12, entries[i].checksum);
+    }
+    putLE32(buf + sizeof(buf) - 4, replayCrc32(buf, sizeof(buf) - 4));
+
+    FILE* file = fopen(INDEX_PATH, "wb");
+    if (!file) return false;
+    bool ok = fwrite(buf, 1, sizeof(buf), file) == sizeof(buf);
+    fclose(file);
+    return ok;
+}
+
+void ReplayLibrary::rebuildIndex() {
+    // Blocks are checksummed but not decoded - they are validated properly when a slot is loaded
+    uint8_t chunk[512];
+
+    for (int i = 0; i < REPLAY_SLOT_COUNT; i++) {
+        entries[i] = SlotEntry();
+
+        FILE* file = fopen(slotPaths[i], "rb");
+        if (!file) continue;
+
+        RecordingInfo info;
+        if (readRecordingInfo(file, info)) {
+            entries[i].frameCount = info.frameCount;
+            entries[i].durationMs = info.durationMs;
+
+            size_t got;
+            while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+                entries[i].checksum = replayCrc32(chunk, got, entries[i].checksum);
+            }
+        } else {
+            // Legacy file: bare frame count, 24-byte frames (no checksum to record)
+            uint8_t word[4];
+            if (fseek(file, 0, SEEK_SET) == 0 && fread(word, 1, 4, file) == 4 && getLE32(word) <= 15000) {
+                entries[i].frameCount = getLE32(word);
+
+                // Duration comes from the last frame's timestamp
+                long last = 4 + (long)(entries[i].frameCount - 1) * 24;
+                if (entries[i].frameCount > 0 && fseek(file, last, SEEK_SET) == 0 &&
+                    fread(word, 1, 4, file) == 4) {
+                    entries[i].durationMs = getLE32(word) / 1000;
+                }
+            }
+        }
+
+        if (fseek(file, 0, SEEK_END) == 0) {
+            long size = ftell(file);
+            entries[i].fileSize = size > 0 ? size : 0;
+        }
+        fclose(file);
+    }
+}
+
+void ReplayLibrary::updateSlot(int slot, const SlotEntry& entry) {
+    if (!isValidSlot(slot)) return;
+    entries[slot] = entry;
+    saveIndex();
+}
+
+void ReplayLibrary::clearSlot(int slot) {
+    updateSlot(slot, SlotEntry());
+}
+
+bool ReplayLibrary::embed(int slot, const asset& recording) {
+    if (!isValidSlot(slot) || recording.buf == nullptr || recording.size == 0) return false;
+
+    EmbeddedRecording entry;
+    if (!openRecordingBuffer(recording.buf, recording.size, entry.info, entry.blocks, entry.size)) {
+        return false;
+    }
+    embedded[slot] = entry;
+    return true;
+}
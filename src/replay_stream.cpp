@@ -0,0 +1,447 @@
+#include "replay_stream.h"
+#include "pros/rtos.hpp"
+
+// --------------------- Part files ---------------------
+
+std::string replayPartPath(const char* path) {
+    return std::string(path) + ".part";
+}
+
+std::string replayBackupPath(const char* path) {
+    return std::string(path) + ".bak";
+}
+
+// Size of a file, or -1 if it can't be opened
+static long fileSize(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return -1;
+    long size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    fclose(file);
+    return size;
+}
+
+// One block at a time: header plus the largest payload
+static ByteBuffer recoveryBlock;
+
+bool prepareRecovery() {
+    return recoveryBlock.reserve(REPLAY_BLOCK_HEADER_SIZE + REPLAY_MAX_BLOCK_PAYLOAD);
+}
+
+void discardPartFile(const char* partPath) {
+    if (remove(partPath) == 0) return;
+
+    // No delete support - an empty part file is ignored by recovery
+    FILE* file = fopen(partPath, "wb");
+    if (file) fclose(file);
+}
+
+bool recoverRecording(const char* partPath, const char* path, RecordingInfo* recovered) {
+    FILE* in = fopen(partPath, "rb");
+    if (!in) return false;
+
+    RecordingInfo info;
+    if (!readRecordingInfo(in, info, true)) {
+        fclose(in);
+        return false;
+    }
+
+    if (!recoveryBlock.resize(REPLAY_BLOCK_HEADER_SIZE + REPLAY_MAX_BLOCK_PAYLOAD)) {
+        fclose(in);
+        return false;
+    }
+
+    // Header counts are rebuilt from the blocks that survived
+    info.frameCount = 0;
+    info.durationMs = 0;
+    info.flags |= REPLAY_FLAG_STREAMING;
+
+    std::vector<uint8_t> header;
+    FILE* out = nullptr;  // Only opened once there's a block worth keeping
+    bool ok = true;
+
+    while (true) {
+        uint8_t* h = recoveryBlock.data();
+        if (fread(h, 1, REPLAY_BLOCK_HEADER_SIZE, in) != REPLAY_BLOCK_HEADER_SIZE) break;
+
+        uint16_t count = getLE16(h);
+        uint32_t payloadSize = getLE32(h + 4);
+        if (!checkBlockHeader(info, h)) break;
+        if (fread(h + REPLAY_BLOCK_HEADER_SIZE, 1, payloadSize, in) != payloadSize) break;
+        if (replayCrc32(h + REPLAY_BLOCK_HEADER_SIZE, payloadSize) != getLE32(h + 8)) break;
+
+        // Decode it too, for the last timestamp and to be sure playback will accept it
+        size_t blockSize = REPLAY_BLOCK_HEADER_SIZE + payloadSize;
+        RecordingReader reader(info, h, blockSize);
+        RecordedFrame frame;
+        uint16_t decoded = 0;
+        while (reader.next(frame)) decoded++;
+        if (decoded != count) break;
+
+        if (!out) {
+            out = fopen(path, "wb");
+            writeRecordingHeader(info, header);
+            if (!out || fwrite(header.data(), 1, header.size(), out) != header.size()) {
+                ok = false;
+                break;
+            }
+        }
+        if (fwrite(h, 1, blockSize, out) != blockSize) {
+            ok = false;
+            break;
+        }
+
+        info.frameCount += count;
+        info.durationMs = frame.timestamp / 1000;
+    }
+    fclose(in);
+
+    if (!out) return false;
+
+    // Same channel list, so the finalized header is the same size
+    info.flags &= ~REPLAY_FLAG_STREAMING;
+    header.clear();
+    writeRecordingHeader(info, header);
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 &&
+         fwrite(header.data(), 1, header.size(), out) == header.size();
+    fclose(out);
+
+    if (ok && recovered) *recovered = info;
+    return ok;
+}
+
+bool commitRecording(const char* partPath, const char* path) {
+    // FAT rename won't replace an existing file, so move the old one aside
+    // rather than deleting it - it goes only once the new one is in place
+    std::string backupPath = replayBackupPath(path);
+    remove(backupPath.c_str());
+    bool backedUp = rename(path, backupPath.c_str()) == 0;
+
+    bool ok = rename(partPath, path) == 0;
+    if (!ok && recoverRecording(partPath, path)) {
+        discardPartFile(partPath);
+        ok = true;
+    }
+
+    if (backedUp) {
+        if (ok) remove(backupPath.c_str());
+        else rename(backupPath.c_str(), path);
+    }
+    return ok;
+}
+
+bool restoreBackup(const char* path) {
+    std::string backupPath = replayBackupPath(path);
+    long backupSize = fileSize(backupPath.c_str());
+    if (backupSize < 0) return false;
+
+    // The new recording made it (or there was never a backup worth keeping)
+    if (fileSize(path) > 0 || backupSize == 0) {
+        remove(backupPath.c_str());
+        return false;
+    }
+
+    remove(path);
+    return rename(backupPath.c_str(), path) == 0;
+}
+
+// --------------------- ReplayStreamWriter ---------------------
+
+bool ReplayStreamWriter::prepare() {
+    RecordingInfo layout;
+    initRecordingInfo(layout);
+    return buffers[0].init(layout) && buffers[1].init(layout) &&
+           blockBuffer.reserve(worstCaseBlocksSize(layout, REPLAY_FRAMES_PER_BLOCK));
+}
+
+bool ReplayStreamWriter::begin(const char* path, uint8_t flags, uint16_t batteryMv) {
+    if (file) return false;
+
+    // Write next to the old recording so it survives until this one is complete
+    targetPath = path;
+    partPath = replayPartPath(path);
+    file = fopen(partPath.c_str(), "wb");
+    if (!file) return false;
+
+    initRecordingInfo(info);
+    info.flags |= flags | REPLAY_FLAG_STREAMING;  // Streaming is cleared once the header is finalized
+    info.batteryMv = batteryMv;
+
+    // Normally a no-op - prepare() has already carved the buffers
+    if (!buffers[0].init(info) || !buffers[1].init(info) ||
+        !blockBuffer.reserve(worstCaseBlocksSize(info, REPLAY_FRAMES_PER_BLOCK))) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+    activeBuffer = 0;
+    writeBuffer = 0;
+    bufferFull[0] = bufferFull[1] = false;
+    stopRequested = false;
+    writeFailed = false;
+    acceptedFrames = 0;
+    droppedFrames = 0;
+    lastTimestamp = 0;
+    blockStartTimestamp = 0;
+    blocksCrc = 0;
+    fileSize = 0;
+
+    if (!writeHeader()) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    // Low priority so it only runs while opcontrol is sleeping between frames
+    taskRunning = true;
+    pros::Task flusher([this] { flushTask(); }, TASK_PRIORITY_MIN + 1, TASK_STACK_DEPTH_DEFAULT,
+                       "replay flush");
+    return true;
+}
+
+bool ReplayStreamWriter::swapBuffers() {
+    uint8_t other = activeBuffer ^ 1;
+    if (bufferFull[other]) return false;  // Task hasn't written the other one yet
+
+    bufferFull[activeBuffer] = true;
+    activeBuffer = other;
+    buffers[activeBuffer].clear();
+    return true;
+}
+
+bool ReplayStreamWriter::addFrame(const RecordedFrame& frame) {
+    if (!file) return false;
+
+    // Still full from last frame: the SD card is a whole block behind.
+    // Drop the frame rather than stall the drive loop.
+    if (buffers[activeBuffer].full() && !swapBuffers()) {
+        droppedFrames++;
+        return false;
+    }
+
+    if (buffers[activeBuffer].size() == 0) blockStartTimestamp = frame.timestamp;
+    buffers[activeBuffer].push(frame);
+    acceptedFrames++;
+    lastTimestamp = frame.timestamp;
+
+    // Hand a full block to the flush task straight away, and a partial one once
+    // it's a checkpoint old so it reaches the card. If the task is still busy
+    // with the other buffer, keep filling and try again next frame.
+    if (buffers[activeBuffer].full() ||
+        frame.timestamp - blockStartTimestamp >= REPLAY_CHECKPOINT_MS * 1000) {
+        swapBuffers();
+    }
+    return true;
+}
+
+bool ReplayStreamWriter::writeHeader() {
+    std::vector<uint8_t> header;
+    writeRecordingHeader(info, header);
+    headerSize = header.size();
+    return fwrite(header.data(), 1, header.size(), file) == header.size() && fflush(file) == 0;
+}
+
+bool ReplayStreamWriter::writeBlock(uint8_t index) {
+    const ColumnBlock& block = buffers[index];
+    uint16_t count = block.size();
+    if (count == 0) return true;
+
+    blockBuffer.clear();
+    if (!encodeBlock(info, block, blockBuffer)) return false;
+    // Flush every block so it is on the card if the brain loses power
+    if (fwrite(blockBuffer.data(), 1, blockBuffer.size(), file) != blockBuffer.size()) return false;
+    if (fflush(file) != 0) return false;
+
+    blocksCrc = replayCrc32(blockBuffer.data(), blockBuffer.size(), blocksCrc);
+    fileSize += blockBuffer.size();
+    info.frameCount += count;
+    RecordedFrame last;
+    block.getFrame(count - 1, last);
+    info.durationMs = last.timestamp / 1000;
+    return true;
+}
+
+void ReplayStreamWriter::flushTask() {
+    while (true) {
+        // Sample before draining: finish() marks the tail full before it requests the stop
+        bool stopping = stopRequested;
+
+        // Buffers fill strictly alternately, so writing in that order keeps frames in sequence
+        while (bufferFull[writeBuffer]) {
+            if (!writeBlock(writeBuffer)) writeFailed = true;
+            bufferFull[writeBuffer] = false;
+            writeBuffer ^= 1;
+        }
+
+        if (stopping) break;
+        pros::delay(10);
+    }
+    taskRunning = false;
+}
+
+bool ReplayStreamWriter::finish() {
+    if (!file) return false;
+
+    // Hand the partially filled buffer to the task as the tail block
+    if (buffers[activeBuffer].size() > 0) bufferFull[activeBuffer] = true;
+    stopRequested = true;
+
+    // Only the tail is left to write, so this is a short wait
+    while (taskRunning) {
+        pros::delay(2);
+    }
+
+    bool ok = !writeFailed;
+
+    // Rewrite the header with the final frame count now that it is known
+    if (ok) {
+        info.flags &= ~REPLAY_FLAG_STREAMING;
+        ok = fseek(file, 0, SEEK_SET) == 0 && writeHeader();
+    }
+
+    fileSize += headerSize;
+    fclose(file);
+    file = nullptr;
+
+    // On failure the part file is left for recoverRecording() to salvage
+    return ok && commitRecording(partPath.c_str(), targetPath.c_str());
+}
+
+void ReplayStreamWriter::abort() {
+    if (!file) return;
+
+    // The tail block is never handed over - the task only finishes what it already has
+    stopRequested = true;
+    while (taskRunning) {
+        pros::delay(2);
+    }
+
+    fclose(file);
+    file = nullptr;
+    discardPartFile(partPath.c_str());
+}
+
+// --------------------- ReplayStreamReader ---------------------
+
+bool ReplayStreamReader::open(const char* path) {
+    if (file) return false;
+
+    file = fopen(path, "rb");
+    if (!file) return false;
+
+    if (!readRecordingInfo(file, info)) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    for (uint8_t i = 0; i < SLOT_COUNT; i++) slotReady[i] = false;
+    fillSlot = 0;
+    playSlot = 0;
+    blockOpen = false;
+    stopRequested = false;
+    endOfFile = false;
+    readFailed = false;
+    underruns = 0;
+
+    // Fill the ring before playback starts so the first frames never wait
+    taskRunning = true;
+    pros::Task prefetcher([this] { prefetchTask(); }, TASK_PRIORITY_DEFAULT + 1, TASK_STACK_DEPTH_DEFAULT,
+                          "replay prefetch");
+    while (taskRunning && !slotReady[0] && !endOfFile) {
+        pros::delay(1);
+    }
+
+    // First block bad: stop the task and let go of the file, so the next open() can start over.
+    // A bad block further on is next()'s to report - the task may already be past the first.
+    if (readFailed && !slotReady[0]) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool ReplayStreamReader::readBlock(uint8_t slot) {
+    uint8_t* data = slots[slot];
+    size_t got = fread(data, 1, REPLAY_BLOCK_HEADER_SIZE, file);
+    if (got == 0) {
+        endOfFile = true;
+        return true;
+    }
+    if (got != REPLAY_BLOCK_HEADER_SIZE) return false;  // Truncated block header
+
+    // A corrupt header would otherwise reach the decoder with a bad frame count or encoding
+    if (!checkBlockHeader(info, data)) return false;
+    uint32_t payloadSize = getLE32(data + 4);
+    uint32_t crc = getLE32(data + 8);
+
+    uint8_t* payload = data + REPLAY_BLOCK_HEADER_SIZE;
+    if (fread(payload, 1, payloadSize, file) != payloadSize) return false;
+    if (replayCrc32(payload, payloadSize) != crc) return false;
+
+    slotSizes[slot] = REPLAY_BLOCK_HEADER_SIZE + payloadSize;
+    slotReady[slot] = true;
+    return true;
+}
+
+void ReplayStreamReader::prefetchTask() {
+    while (!stopRequested && !endOfFile) {
+        if (slotReady[fillSlot]) {
+            // Ring is full - wait for playback to hand a slot back
+            pros::delay(5);
+            continue;
+        }
+
+        if (!readBlock(fillSlot)) {
+            readFailed = true;
+            break;
+        }
+        if (slotReady[fillSlot]) fillSlot = (fillSlot + 1) % SLOT_COUNT;
+    }
+    taskRunning = false;
+}
+
+bool ReplayStreamReader::next(RecordedFrame& frame) {
+    if (!file) return false;
+
+    while (true) {
+        if (blockOpen) {
+            if (blockReader.next(frame)) return true;
+
+            // Block finished - give the slot back to the prefetch task
+            blockOpen = false;
+            slotReady[playSlot] = false;
+            playSlot = (playSlot + 1) % SLOT_COUNT;
+        }
+
+        if (!slotReady[playSlot]) {
+            if (!taskRunning) {
+                // Prefetch has stopped (end of recording or a bad block) and nothing is left
+                if (!slotReady[playSlot]) return false;
+                continue;
+            }
+
+            // SD card fell behind playback
+            underruns++;
+            while (!slotReady[playSlot] && taskRunning) {
+                pros::delay(1);
+            }
+            continue;
+        }
+
+        blockReader = RecordingReader(info, slots[playSlot], slotSizes[playSlot]);
+        blockOpen = true;
+    }
+}
+
+void ReplayStreamReader::close() {
+    if (!file) return;
+
+    stopRequested = true;
+    while (taskRunning) {
+        pros::delay(1);
+    }
+
+    fclose(file);
+    file = nullptr;
+    blockOpen = false;
+}
@@ -0,0 +1,50 @@
+#include "replay_timing.h"
+
+void TimingStats::reset() {
+    for (size_t i = 0; i < BUCKET_COUNT; i++) buckets[i] = 0;
+    count = 0;
+    minUs = 0;
+    maxUs = 0;
+    totalUs = 0;
+}
+
+void TimingStats::add(uint32_t latenessUs) {
+    size_t bucket = latenessUs / BUCKET_US;
+    if (bucket >= BUCKET_COUNT) bucket = BUCKET_COUNT - 1;
+    buckets[bucket]++;
+
+    if (count == 0 || latenessUs < minUs) minUs = latenessUs;
+    if (latenessUs > maxUs) maxUs = latenessUs;
+    totalUs += latenessUs;
+    count++;
+}
+
+uint32_t TimingStats::getP99Us() const {
+    if (count == 0) return 0;
+
+    // Smallest bucket with at least 99% of samples at or below it
+    uint32_t target = count - count / 100;
+    uint32_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            // The last bucket is open-ended - max is the best bound there
+            uint32_t edge = (i + 1) * BUCKET_US;
+            return i == BUCKET_COUNT - 1 || edge > maxUs ? maxUs : edge;
+        }
+    }
+    return maxUs;
+}
+
+bool distanceToTime(uint32_t fromTime, float fromTravel, uint32_t toTime, float toTravel, float travelled,
+                    uint64_t& time) {
+    if (toTime <= fromTime) return false;
+    float span = toTravel - fromTravel;
+    if (span / ((toTime - fromTime) / 1e6f) < REPLAY_DISTANCE_MIN_SPEED) return false;
+
+    float fraction = (travelled - fromTravel) / span;
+    if (fraction < 0.0f) fraction = 0.0f;
+    if (fraction > 1.0f) fraction = 1.0f;
+    time = fromTime + static_cast<uint64_t>(fraction * (toTime - fromTime));
+    return true;
+}
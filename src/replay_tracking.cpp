@@ -0,0 +1,62 @@
+#include "replay_tracking.h"
+#include <cmath>
+
+constexpr float PI = 3.14159265f;
+constexpr float METERS_PER_INCH = 0.0254f;
+
+float wrapRadians(float angle) {
+    while (angle > PI) angle -= 2 * PI;
+    while (angle <= -PI) angle += 2 * PI;
+    return angle;
+}
+
+void RamseteTracker::compute(const TrackPose& target, float targetV, float targetOmega, const TrackPose& actual,
+                             float& v, float& omega) const {
+    // Gains are metric, so work in meters
+    float dx = (target.x - actual.x) * METERS_PER_INCH;
+    float dy = (target.y - actual.y) * METERS_PER_INCH;
+    float vRef = targetV * METERS_PER_INCH;
+
+    // Error in the robot's own frame: ahead/behind, left/right, and heading
+    float c = std::cos(actual.theta);
+    float s = std::sin(actual.theta);
+    float errorX = c * dx + s * dy;
+    float errorY = -s * dx + c * dy;
+    float errorTheta = wrapRadians(target.theta - actual.theta);
+
+    float k = 2.0f * gains.zeta * std::sqrt(targetOmega * targetOmega + gains.b * vRef * vRef);
+
+    // sin(x)/x, which tends to 1 as the heading error vanishes
+    float sinc = std::fabs(errorTheta) < 1e-4f ? 1.0f : std::sin(errorTheta) / errorTheta;
+
+    v = (vRef * std::cos(errorTheta) + k * errorX) / METERS_PER_INCH;
+    omega = targetOmega + k * errorTheta + gains.b * vRef * sinc * errorY;
+}
+
+float unwrapDegrees(float heading, float reference) {
+    float delta = std::fmod(heading - reference, 360.0f);
+    if (delta > 180.0f) delta -= 360.0f;
+    if (delta <= -180.0f) delta += 360.0f;
+    return reference + delta;
+}
+
+float HeadingPID::compute(float error, float rate, float forward, float dt) {
+    // Gain schedule: full gains at rest, highSpeedScale of them at full speed
+    float speed = std::fabs(forward) / 127.0f;
+    if (speed > 1.0f) speed = 1.0f;
+    float schedule = 1.0f + (gains.highSpeedScale - 1.0f) * speed;
+
+    float unclamped = schedule * gains.kP * error + integral - gains.kD * rate;
+    float output = unclamped;
+    if (output > gains.maxCorrection) output = gains.maxCorrection;
+    if (output < -gains.maxCorrection) output = -gains.maxCorrection;
+
+    // Conditional integration: hold the integral while it would only push further into the clamp
+    bool saturated = output != unclamped && (unclamped > 0) == (error > 0);
+    if (!saturated) {
+        integral += schedule * gains.kI * error * dt;
+        if (integral > gains.integralLimit) integral = gains.integralLimit;
+        if (integral < -gains.integralLimit) integral = -gains.integralLimit;
+    }
+    return output;
+}
@@ -144,14 +144,15 @@ void drawLockScreen() {
     pros::screen::print(pros::E_TEXT_MEDIUM, 140, 180, "Auton: %s", autonNames[autonSelection]);
 }
 
-void handleScreenTouch() {
-    if (selectorLocked) return;
+bool handleScreenTouch() {
+    if (selectorLocked) return false;
     
     pros::screen_touch_status_s_t status = pros::screen::touch_status();
     
     if (status.touch_status == pros::E_TOUCH_PRESSED) {
         int x = status.x;
         int y = status.y;
+        int previous = autonSelection;
         
         // Determine which quadrant was pressed
         if (x < 240 && y < 120) autonSelection = 0; // Top-left: Skills
@@ -161,19 +162,26 @@ void handleScreenTouch() {
         
         drawAutonSelector();
         pros::delay(200); // Debounce
+        return autonSelection != previous;
     }
+    return false;
 }
 
-void runAutonSelector(uint32_t timeout_ms) {
+void runAutonSelector(uint32_t timeout_ms, void (*onSelect)(int)) {
     // RESET lock state for new match/run
     selectorLocked = false;
     
     uint32_t startTime = pros::millis();
     drawAutonSelector();
     
+    // Let the caller prepare the current selection straight away
+    if (onSelect) onSelect(autonSelection);
+    
     while (true) {
         // Handle input
-        handleScreenTouch();
+        if (handleScreenTouch() && onSelect) {
+            onSelect(autonSelection);
+        }
         
         // Exit condition 1: Timeout reached (if not infinite/0)
         if (timeout_ms > 0 && (pros::millis() - startTime > timeout_ms)) {
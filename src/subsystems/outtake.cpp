@@ -7,38 +7,59 @@ OuttakeControl::OuttakeControl()
       midScoringMode(false), X_lastState(false),
       unjamStartTime(0), isUnjamming(false) {}
 
+void OuttakeControl::setMidScoring(bool enabled) {
+    if (enabled == midScoringMode) return;
+    midScoringMode = enabled;
+
+    if (midScoringMode) {
+        // ENTERING mid-scoring mode
+        MidScoring.set_value(true); // Retract piston
+        isUnjamming = true;
+        unjamStartTime = pros::millis();
+    } else {
+        // EXITING mid-scoring mode
+        MidScoring.set_value(false); // Extend piston
+        isUnjamming = false;
+        Intake.move(0); // Stop intake
+        Outtake.move(0); // Stop outtake
+        // Reset toggles so they start fresh
+        toggleForward = false;
+        toggleReverse = false;
+    }
+}
+
+bool OuttakeControl::runUnjam() {
+    if (!isUnjamming) return false;
+
+    if (pros::millis() - unjamStartTime >= 225) {  // Time of delay
+        isUnjamming = false;
+        // Don't set intake here - let it fall through to mid-scoring mode logic
+        return false;
+    }
+    Intake.move(127); // Unjam (reverse)
+    Outtake.move(-127); // Make sure outtake also runs during unjam
+    return true;
+}
+
+bool OuttakeControl::runMidScoring() {
+    if (runUnjam()) return true;
+    if (!midScoringMode) return false;
+
+    // Same outputs update() gives mid-scoring after the unjam
+    Intake.move(-127);
+    Outtake.move(-127);
+    return true;
+}
+
 void OuttakeControl::update() {
     // Handle unjam sequence
-    if (isUnjamming) {
-        if (pros::millis() - unjamStartTime >= 225) {  // Time of delay
-            isUnjamming = false;
-            // Don't set intake here - let it fall through to mid-scoring mode logic below
-        } else {
-            Intake.move(127); // Unjam (reverse)
-            Outtake.move(-127); // Make sure outtake also runs during unjam
-            return; // Exit early during unjam
-        }
-    }
+    if (runUnjam()) return; // Exit early during unjam
 
     // Mid Scoring Toggle (Button X)
     bool X_current = master.get_digital(pros::E_CONTROLLER_DIGITAL_X);
     if (X_current && !X_lastState) {
-        midScoringMode = !midScoringMode;
-        
-        if (midScoringMode) {
-            // ENTERING mid-scoring mode
-            MidScoring.set_value(true); // Retract piston
-            isUnjamming = true;
-            unjamStartTime = pros::millis();
-        } else {
-            // EXITING mid-scoring mode
-            MidScoring.set_value(false); // Extend piston
-            isUnjamming = false;
-            Intake.move(0); // Stop intake
-            Outtake.move(0); // Stop outtake
-            // Reset toggles so they start fresh
-            toggleForward = false;
-            toggleReverse = false;
+        setMidScoring(!midScoringMode);
+        if (!midScoringMode) {
             X_lastState = X_current; // Update state BEFORE returning
             return; // Exit function immediately after turning off mid-scoring
         }
@@ -87,4 +108,8 @@ int OuttakeControl::getPower() {
 
 bool OuttakeControl::isMidScoring() {
     return midScoringMode;
+}
+
+bool OuttakeControl::isUnjamActive() {
+    return isUnjamming;
 }
\ No newline at end of file
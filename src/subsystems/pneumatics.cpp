@@ -9,20 +9,28 @@ void PneumaticControl::update() {
     // Descore (Button A)
     bool A_current = master.get_digital(pros::E_CONTROLLER_DIGITAL_A);
     if (A_current && !A_lastState) {
-        descoreState = !descoreState;
-        Descore.set_value(descoreState);
+        setDescore(!descoreState);
     }
     A_lastState = A_current;
 
     // Unloader (Button B)
     bool B_current = master.get_digital(pros::E_CONTROLLER_DIGITAL_B);
     if (B_current && !B_lastState) {
-        unloaderState = !unloaderState;
-        Unloader.set_value(unloaderState);
+        setUnloader(!unloaderState);
     }
     B_lastState = B_current;
 }
 
+void PneumaticControl::setDescore(bool state) {
+    descoreState = state;
+    Descore.set_value(descoreState);
+}
+
+void PneumaticControl::setUnloader(bool state) {
+    unloaderState = state;
+    Unloader.set_value(unloaderState);
+}
+
 bool PneumaticControl::getDescoreState() {
     return descoreState;
 }